@@ -0,0 +1,161 @@
+#define TESTINATOR_MAIN
+#include <testinator.h>
+
+#include "blisp.h"
+
+#include <chrono>
+#include <cstddef>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+//------------------------------------------------------------------------------
+// Each benchmark reports one JSON object per line on stdout, so that a run can
+// be diffed against a baseline:
+//   {"bench": "tokenizer", "value": 12.5, "unit": "MB/s"}
+
+namespace
+{
+  using Clock = chrono::steady_clock;
+
+  double seconds_since(Clock::time_point start)
+  {
+    return chrono::duration<double>(Clock::now() - start).count();
+  }
+
+  void report(const string& name, double value, const string& unit)
+  {
+    cout << "{\"bench\": \"" << name << "\", \"value\": " << value
+         << ", \"unit\": \"" << unit << "\"}" << endl;
+  }
+
+  // (1 2 3 ... n)
+  string number_list(size_t n)
+  {
+    string s = "(";
+    for (size_t i = 1; i <= n; ++i) {
+      s += to_string(i);
+      s += i == n ? ")" : " ";
+    }
+    return s;
+  }
+
+  // a source text of roughly n bytes with a mix of token kinds; comments are
+  // left out because the REPL only ever sees them at the end of a line
+  string source_text(size_t n)
+  {
+    static const string chunk =
+      "(set! f (lambda (x y) (if (= x 0) \"done\" (+ x y 42)))) ";
+    string s;
+    while (s.size() < n) s += chunk;
+    return s;
+  }
+
+  // (let (v0 0) (let (v1 1) ... v0)), so the body looks up v0 from the
+  // innermost of depth environments
+  string nested_lets(size_t depth)
+  {
+    string s;
+    for (size_t i = 0; i < depth; ++i) {
+      s += "(let (v" + to_string(i) + " " + to_string(i) + ") ";
+    }
+    s += "v0";
+    s += string(depth, ')');
+    return s;
+  }
+
+  FormPtr run(const string& s, Environment& e)
+  {
+    return eval(read(s), e);
+  }
+}
+
+//------------------------------------------------------------------------------
+
+DEF_TIMED_TEST(Tokenizer, Bench)
+{
+  auto s = source_text(1 << 20);
+  auto start = Clock::now();
+  auto tokens = tokenizer(s);
+  auto t = seconds_since(start);
+  report("tokenizer", s.size() / t / (1 << 20), "MB/s");
+}
+
+DEF_TIMED_TEST(Reader, Bench)
+{
+  constexpr size_t n = 100000;
+  auto s = number_list(n);
+  auto start = Clock::now();
+  auto f = read(s);
+  auto t = seconds_since(start);
+  report("reader", n / t, "forms/s");
+}
+
+DEF_TIMED_TEST(Fib, Bench)
+{
+  auto e = create_base_env();
+  run("(set! fib (lambda (n) (if (= n 0) 0 (if (= n 1) 1 "
+      "(+ (fib (- n 1)) (fib (- n 2)))))))", *e);
+  auto start = Clock::now();
+  run("(fib 25)", *e);
+  report("fib 25", seconds_since(start) * 1e3, "ms");
+}
+
+DEF_TIMED_TEST(EnvironmentLookup, Bench)
+{
+  auto e = create_base_env();
+  for (size_t depth : { 1, 10, 100, 1000 }) {
+    auto f = read(nested_lets(depth));
+    constexpr size_t reps = 100;
+    auto start = Clock::now();
+    for (size_t i = 0; i < reps; ++i) eval(f, *e);
+    auto t = seconds_since(start);
+    // each rep also builds depth environments, so report per binding
+    report("env lookup depth " + to_string(depth),
+           t / reps / depth * 1e9, "ns/level");
+  }
+}
+
+DEF_TIMED_TEST(ArithmeticLoop, Bench)
+{
+  auto e = create_base_env();
+  run("(set! loop (lambda (n acc) (if (= n 0) acc "
+      "(loop (- n 1) (+ acc (* n 3))))))", *e);
+  constexpr size_t n = 1000;
+  constexpr size_t reps = 10;
+  auto f = read("(loop 1000 0)");
+  auto start = Clock::now();
+  for (size_t i = 0; i < reps; ++i) eval(f, *e);
+  report("arithmetic loop", n * reps / seconds_since(start), "iterations/s");
+}
+
+DEF_TIMED_TEST(ListConstruction, Bench)
+{
+  auto e = create_base_env();
+  constexpr size_t n = 10000;
+  constexpr size_t reps = 10;
+  auto s = "(quote " + number_list(n) + ")";
+  auto start = Clock::now();
+  for (size_t i = 0; i < reps; ++i) run(s, *e);
+  report("list construction", n * reps / seconds_since(start), "elements/s");
+}
+
+DEF_TIMED_TEST(Print, Bench)
+{
+  constexpr size_t n = 100000;
+  auto f = read(number_list(n));
+  auto start = Clock::now();
+  auto s = f->print();
+  auto t = seconds_since(start);
+  report("print", s.size() / t / (1 << 20), "MB/s");
+}
+
+DEF_TIMED_TEST(Startup, Bench)
+{
+  constexpr size_t reps = 100;
+  auto start = Clock::now();
+  for (size_t i = 0; i < reps; ++i) create_base_env();
+  report("startup", seconds_since(start) / reps * 1e6, "us");
+}
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <iosfwd>
+#include <map>
+#include <memory>
+#include <string>
+#include <typeinfo>
+#include <vector>
+
+//------------------------------------------------------------------------------
+// The interpreter's public surface: enough to read, evaluate and print forms
+// from the REPL, the benchmarks and the tests.
+
+struct Form;
+using FormPtr = std::shared_ptr<Form>;
+
+using Token = std::string;
+
+// called with the type and size of each form and environment created, while
+// the allocation profiler is on
+extern void (*allocation_hook)(const std::type_info&, size_t);
+
+//------------------------------------------------------------------------------
+
+class Environment
+{
+public:
+  Environment(Environment* parent = nullptr)
+    : m_parent(parent)
+  {
+    if (allocation_hook) {
+      allocation_hook(typeid(Environment), sizeof(Environment));
+    }
+  }
+
+  FormPtr lookup(const std::string& s)
+  {
+    auto i = m_bindings.find(s);
+    if (i == m_bindings.end()) {
+      if (!m_parent) return nullptr;
+      return m_parent->lookup(s);
+    }
+    return i->second;
+  }
+
+  void set(const std::string&s, const FormPtr& f)
+  {
+    m_bindings.emplace(s, f);
+  }
+
+  Environment* find(const std::string& s)
+  {
+    auto i = m_bindings.find(s);
+    if (i == m_bindings.end()) {
+      if (!m_parent) return nullptr;
+      return m_parent->find(s);
+    }
+    return this;
+  }
+
+  const std::map<std::string, FormPtr>& bindings() const
+  {
+    return m_bindings;
+  }
+
+  Environment* parent() const { return m_parent; }
+
+private:
+  std::map<std::string, FormPtr> m_bindings;
+  Environment* m_parent;
+};
+
+//------------------------------------------------------------------------------
+
+// the number of forms constructed and destroyed while anything counts them
+// (form_counters is nonzero), for profiling and metrics; only the evaluating
+// thread creates forms, so the counts are read and written without a
+// read-modify-write
+extern std::atomic<uint64_t> forms_created;
+extern std::atomic<uint64_t> forms_destroyed;
+extern unsigned form_counters;
+
+inline void bump(std::atomic<uint64_t>& count)
+{
+  count.store(count.load(std::memory_order_relaxed) + 1,
+              std::memory_order_relaxed);
+}
+
+struct Form : public std::enable_shared_from_this<Form>
+{
+  Form()
+    : m_counted(form_counters != 0)
+  {
+    if (m_counted) bump(forms_created);
+  }
+  virtual ~Form()
+  {
+    if (m_counted) bump(forms_destroyed);
+  }
+  virtual FormPtr eval(Environment&) { return shared_from_this(); }
+  virtual std::string print() const { return "<form>"; }
+  virtual bool is_truthy() const { return true; }
+  virtual FormPtr apply(Environment&) const { return FormPtr{}; };
+
+  // hashing and equality, so that forms can be used as keys
+  virtual size_t hash() const { return std::hash<const Form*>{}(this); }
+  virtual bool equals(const Form& f) const { return this == &f; }
+
+  // convenience for checking symbol equality
+  virtual bool symb_eq(const std::string&) { return false; }
+
+  // where the reader found this form, as a source id (0 if unknown)
+  uint32_t m_source = 0;
+
+  // whether this form's construction was counted, so that its destruction
+  // is counted to match
+  bool m_counted;
+};
+
+//------------------------------------------------------------------------------
+
+std::vector<Token> tokenizer(const std::string& s);
+FormPtr read(const std::string& s);
+// read text starting at a line of a source file, as numbered by source_file,
+// giving each form read a source id
+FormPtr read(const std::string& s, uint32_t file, uint32_t line);
+uint32_t source_file(const std::string& name);
+
+struct SourceLocation
+{
+  uint32_t file;
+  uint32_t line;
+  uint32_t column;
+};
+// the location of a source id, or all zeroes for 0
+SourceLocation source_location(uint32_t id);
+// "file:line:col"
+std::string to_string(const SourceLocation& l);
+FormPtr eval(const FormPtr& form, Environment& e);
+void print(const FormPtr& form);
+std::unique_ptr<Environment> create_base_env();
+
+// Sampling profiler: samples the Lisp call stack hz times per second of CPU
+// time, and on stop writes collapsed stacks ("a;b;c count") for flamegraphs
+bool profile_start(unsigned hz);
+void profile_stop(std::ostream& os);
+
+// Deterministic profiler: counts calls, inclusive and exclusive time and form
+// allocations per function while on
+void profile_calls(bool on);
+void profile_report(std::ostream& os);
+
+// Allocation profiler: attributes every form and environment created to its
+// type and the Lisp function creating it, keeping the whole stack for one in
+// every period allocations; a period of 0 turns it off
+void profile_allocations(unsigned period);
+void allocation_report(std::ostream& os);
+
+// Event tracing into per-thread ring buffers, written out on stop in Chrome
+// trace-event JSON
+void trace_start();
+void trace_stop(std::ostream& os);
+
+// Linux perf integration: applies each Lisp function through a trampoline
+// named after it in /tmp/perf-<pid>.map
+bool perf_map_start();
+
+// Metrics: serves runtime counters in Prometheus text format to each
+// connection on a Unix socket at path, from a background thread
+bool metrics_start(const std::string& path);
+void metrics_stop();
+
+// Coverage: counts evaluations of each list, and the branches taken by each
+// if, read after starting; writes an lcov tracefile keyed by file and line
+void coverage_start();
+void coverage_write(std::ostream& os);
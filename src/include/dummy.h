@@ -1 +0,0 @@
-int dummy();
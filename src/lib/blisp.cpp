@@ -0,0 +1,6366 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bitset>
+#include <cmath>
+#include <cctype>
+#include <cerrno>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <sstream>
+#include <regex>
+#include <set>
+#include <string>
+#include <thread>
+#include <typeindex>
+#include <typeinfo>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#if !defined(_WIN32)
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__) && defined(__x86_64__)
+#include <sys/mman.h>
+#endif
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#include "blisp.h"
+
+using namespace std;
+
+//------------------------------------------------------------------------------
+// TODOs:
+// lambdas close over values in env (lexical scope)
+// lazy tokenization
+// get rid of dynamic casts
+// too much shared_ptr overuse
+// TCO
+// other lisp features
+//------------------------------------------------------------------------------
+
+namespace
+{
+  template <typename InputIt, typename OutputIt>
+  OutputIt escape(InputIt first,
+                  InputIt last,
+                  OutputIt dest)
+  {
+    for (; first != last; ++first)
+    {
+      if (*first == '\n') {
+        *dest++ = '\\';
+        *dest++ = 'n';
+      } else if (*first == '\\'
+                 || *first == '\"') {
+        *dest++ = '\\';
+        *dest++ = *first;
+      } else {
+        *dest++ = *first;
+      }
+    }
+    return dest;
+  }
+
+  template <typename InputIt, typename OutputIt>
+  OutputIt unescape(InputIt first,
+                    InputIt last,
+                    OutputIt dest)
+  {
+    for (; first != last; ++first)
+    {
+      if (*first == '\\') {
+        ++first;
+        switch (*first) {
+          case 'n': *dest++ = '\n'; break;
+          default: *dest++ = *first; break;
+        }
+      } else {
+        *dest++ = *first;
+      }
+    }
+    return dest;
+  }
+
+  // FNV-1a
+  size_t hash_chars(const char* p, size_t n)
+  {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < n; ++i) {
+      h = (h ^ static_cast<unsigned char>(p[i])) * 0x100000001b3ULL;
+    }
+    return static_cast<size_t>(h);
+  }
+}
+
+//------------------------------------------------------------------------------
+
+namespace
+{
+  // offsets, when given, receives each token's offset into s
+  vector<Token> tokenize(const string& s, vector<uint32_t>* offsets)
+  {
+    static const string tokenPattern =
+      R"([[:space:],]*()" // open paren after separator
+      R"(~@)"
+      R"(|[][{}()~@^'`])" // other characters
+      R"(|"(\\.|[^\"])*")" // string
+      R"(|;.*)" // comment
+      R"(|[^][[:space:]{}();,^'`\"]+)" // atom
+      R"())"; // close paren
+
+    static const regex re(tokenPattern, regex::extended);
+
+    vector<Token> v;
+    for (auto i = sregex_iterator(s.cbegin(), s.cend(), re);
+         i != sregex_iterator(); ++i) {
+      v.push_back(i->str(1));
+      if (offsets) offsets->push_back(static_cast<uint32_t>(i->position(1)));
+    }
+    return v;
+  }
+}
+
+vector<Token> tokenizer(const string& s)
+{
+  return tokenize(s, nullptr);
+}
+
+//------------------------------------------------------------------------------
+// Source locations. Each read of text from a source file reserves a range of
+// source ids, one per character, and each form read gets the id of its first
+// character. A chunk per read maps its ids back to file, line and column, so
+// a form carries just 32 bits and nothing per form is kept on the side.
+
+namespace
+{
+  vector<string> source_files = {"<unknown>"};
+
+  struct SourceChunk
+  {
+    uint32_t base;
+    uint32_t file;
+    uint32_t line;
+    // offsets at which the second and later lines of the text start
+    vector<uint32_t> line_starts;
+  };
+
+  vector<SourceChunk> source_chunks;
+  uint32_t next_source_id = 1;
+
+  // reserves ids for text, returning the first, or 0 once ids run out
+  uint32_t source_chunk(const string& s, uint32_t file, uint32_t line)
+  {
+    if (s.size() >= numeric_limits<uint32_t>::max() - next_source_id) {
+      return 0;
+    }
+    SourceChunk c{next_source_id, file, line, {}};
+    for (size_t i = 0; i < s.size(); ++i) {
+      if (s[i] == '\n') c.line_starts.push_back(static_cast<uint32_t>(i + 1));
+    }
+    next_source_id += static_cast<uint32_t>(s.size()) + 1;
+    source_chunks.push_back(std::move(c));
+    return source_chunks.back().base;
+  }
+
+  // " at file:line:col", for error messages about a form
+  string at(const Form& f)
+  {
+    if (!f.m_source) return string();
+    return " at " + to_string(source_location(f.m_source));
+  }
+}
+
+uint32_t source_file(const string& name)
+{
+  auto i = find(source_files.cbegin(), source_files.cend(), name);
+  if (i != source_files.cend()) {
+    return static_cast<uint32_t>(i - source_files.cbegin());
+  }
+  source_files.push_back(name);
+  return static_cast<uint32_t>(source_files.size() - 1);
+}
+
+SourceLocation source_location(uint32_t id)
+{
+  auto c = upper_bound(source_chunks.cbegin(), source_chunks.cend(), id,
+                       [] (uint32_t i, const SourceChunk& chunk) {
+                         return i < chunk.base;
+                       });
+  if (id == 0 || c == source_chunks.cbegin()) return {0, 0, 0};
+  --c;
+  auto offset = id - c->base;
+  auto l = upper_bound(c->line_starts.cbegin(), c->line_starts.cend(), offset);
+  auto line_start = l == c->line_starts.cbegin() ? 0 : *(l - 1);
+  return { c->file,
+           c->line + static_cast<uint32_t>(l - c->line_starts.cbegin()),
+           offset - line_start + 1 };
+}
+
+string to_string(const SourceLocation& l)
+{
+  return source_files[l.file] + ":" + to_string(l.line) + ":"
+    + to_string(l.column);
+}
+
+//------------------------------------------------------------------------------
+
+class Reader
+{
+public:
+  Reader(vector<Token>&& tokens) :m_tokens(std::move(tokens)) {}
+  Reader(vector<Token>&& tokens, vector<uint32_t>&& offsets, uint32_t base)
+    : m_tokens(std::move(tokens)), m_offsets(std::move(offsets)), m_base(base)
+  {}
+
+  Token next() { return m_tokens[pos++]; }
+  Token peek() const { return m_tokens[pos]; }
+  bool empty() const { return pos >= m_tokens.size(); }
+
+  // the source id of the next token
+  uint32_t source() const
+  {
+    return m_base ? m_base + m_offsets[pos] : 0;
+  }
+
+  vector<Token> m_tokens;
+  size_t pos = 0;
+
+  vector<uint32_t> m_offsets;
+  uint32_t m_base = 0;
+};
+
+//------------------------------------------------------------------------------
+
+struct Function;
+struct DispatchCache;
+
+// Forms are created through make_form, so that the allocation profiler can
+// see each one's type
+template <typename T, typename... Args>
+inline shared_ptr<T> make_form(Args&&... args)
+{
+  if (allocation_hook) allocation_hook(typeid(T), sizeof(T));
+  return make_shared<T>(std::forward<Args>(args)...);
+}
+
+// Runtime counters for the metrics endpoint. Each thread owns its counters,
+// so counting needs no read-modify-write and never contends; a scrape sums
+// them over every thread that has counted. Nothing is counted unless the
+// endpoint is running.
+namespace
+{
+  struct ThreadMetrics
+  {
+    atomic<uint64_t> evaluations{0};
+    atomic<uint64_t> calls{0};
+    atomic<uint64_t> map_cache_hits{0};
+    atomic<uint64_t> map_cache_misses{0};
+    atomic<uint64_t> dispatch_cache_hits{0};
+    atomic<uint64_t> dispatch_cache_misses{0};
+  };
+
+  bool collecting_metrics = false;
+  mutex metrics_mutex;
+  vector<unique_ptr<ThreadMetrics>> all_thread_metrics;
+  thread_local ThreadMetrics* this_thread_metrics = nullptr;
+
+  inline void count(atomic<uint64_t> ThreadMetrics::*counter)
+  {
+    if (!collecting_metrics) return;
+    if (!this_thread_metrics) {
+      lock_guard<mutex> lock(metrics_mutex);
+      all_thread_metrics.push_back(make_unique<ThreadMetrics>());
+      this_thread_metrics = all_thread_metrics.back().get();
+    }
+    bump(this_thread_metrics->*counter);
+  }
+}
+
+struct Nil : public Form
+{
+  virtual string print() const { return "nil"; }
+  virtual bool is_truthy() const { return false; }
+
+  virtual size_t hash() const { return 0x6e696c; }
+  virtual bool equals(const Form& f) const
+  {
+    return dynamic_cast<const Nil*>(&f);
+  }
+};
+
+struct True : public Form
+{
+  virtual string print() const { return "true"; }
+
+  virtual size_t hash() const { return 0x74727565; }
+  virtual bool equals(const Form& f) const
+  {
+    return dynamic_cast<const True*>(&f);
+  }
+};
+
+struct False : public Form
+{
+  virtual string print() const { return "false"; }
+  virtual bool is_truthy() const { return false; }
+
+  virtual size_t hash() const { return 0x66616c7365; }
+  virtual bool equals(const Form& f) const
+  {
+    return dynamic_cast<const False*>(&f);
+  }
+};
+
+inline size_t hash_combine(size_t h, size_t x)
+{
+  return h ^ (x + 0x9e3779b9 + (h << 6) + (h >> 2));
+}
+
+inline bool forms_equal(const FormPtr& a, const FormPtr& b)
+{
+  return a == b || (a && b && a->equals(*b));
+}
+
+// lists and slices of lists with equal elements hash alike
+inline size_t hash_forms(const FormPtr* first, const FormPtr* last)
+{
+  size_t h = 0x6c697374;
+  for (; first != last; ++first) {
+    h = hash_combine(h, *first ? (*first)->hash() : 0);
+  }
+  return h | 1;
+}
+
+inline bool forms_equal(const FormPtr* first, const FormPtr* last,
+                        const FormPtr* first2, const FormPtr* last2)
+{
+  return last - first == last2 - first2
+    && equal(first, last, first2,
+             [] (const FormPtr& a, const FormPtr& b) {
+               return forms_equal(a, b);
+             });
+}
+
+FormPtr eval_list(const vector<FormPtr>& v, Environment& e);
+
+// lists evaluate through this, which the debugger, coverage and the
+// allocation profiler swap while they are on
+struct List;
+FormPtr eval_list_form(const List& l, Environment& e);
+using ListEvaluator = FormPtr (*)(const List& l, Environment& e);
+ListEvaluator list_evaluator = eval_list_form;
+// puts f in front of the current evaluator, beneath the debugger if it is
+// attached, returning the evaluator f should chain to; and takes f out
+ListEvaluator insert_list_evaluator(ListEvaluator f);
+void remove_list_evaluator(ListEvaluator f, ListEvaluator next);
+FormPtr call(const Function& f, const vector<FormPtr>& args, Environment& e);
+
+struct List : public Form
+{
+  List(vector<FormPtr>&& v) : m_elements(std::move(v)) {}
+
+  // index of this list's coverage counter, if read while coverage is on;
+  // declared first so that it packs beside Form::m_source
+  uint32_t m_coverage_id = 0;
+
+  virtual string print() const
+  {
+    string s;
+    s.push_back('(');
+    auto i = m_elements.cbegin();
+    if (i != m_elements.cend()) {
+      s += (*i)->print();
+      ++i;
+    }
+    while (i != m_elements.cend()) {
+      s.push_back(' ');
+      s += (*i)->print();
+      ++i;
+    }
+    s.push_back(')');
+    return s;
+  }
+
+  virtual FormPtr eval(Environment& e)
+  {
+    return list_evaluator(*this, e);
+  }
+
+  // lists are immutable, so the hash is computed once on demand
+  virtual size_t hash() const
+  {
+    if (!m_hash) m_hash = hash_forms(begin(), end());
+    return m_hash;
+  }
+
+  virtual bool equals(const Form& f) const;
+
+  const FormPtr* begin() const { return m_elements.data(); }
+  const FormPtr* end() const { return begin() + m_elements.size(); }
+
+  vector<FormPtr> m_elements;
+  mutable size_t m_hash = 0;
+};
+
+FormPtr eval_list_form(const List& l, Environment& e)
+{
+  return eval_list(l.m_elements, e);
+}
+
+// A view of a run of a list's elements, sharing the list's storage
+struct ListSlice : public Form
+{
+  ListSlice(const shared_ptr<List>& list, size_t offset, size_t size)
+    : m_list(list)
+    , m_offset(offset)
+    , m_size(size)
+  {}
+
+  virtual string print() const
+  {
+    string s;
+    s.push_back('(');
+    for (size_t i = 0; i < m_size; ++i) {
+      if (i > 0) s.push_back(' ');
+      s += begin()[i]->print();
+    }
+    s.push_back(')');
+    return s;
+  }
+
+  virtual size_t hash() const
+  {
+    if (!m_hash) m_hash = hash_forms(begin(), end());
+    return m_hash;
+  }
+
+  virtual bool equals(const Form& f) const
+  {
+    if (&f == this) return true;
+    if (auto l = dynamic_cast<const List*>(&f)) {
+      return (!m_hash || !l->m_hash || m_hash == l->m_hash)
+        && forms_equal(begin(), end(), l->begin(), l->end());
+    }
+    if (auto l = dynamic_cast<const ListSlice*>(&f)) {
+      return (!m_hash || !l->m_hash || m_hash == l->m_hash)
+        && forms_equal(begin(), end(), l->begin(), l->end());
+    }
+    return false;
+  }
+
+  const FormPtr* begin() const { return m_list->m_elements.data() + m_offset; }
+  const FormPtr* end() const { return begin() + m_size; }
+
+  shared_ptr<List> m_list;
+  size_t m_offset;
+  size_t m_size;
+  mutable size_t m_hash = 0;
+};
+
+// equal lists can't have different hashes, so compare cached ones first
+bool List::equals(const Form& f) const
+{
+  if (&f == this) return true;
+  if (auto l = dynamic_cast<const List*>(&f)) {
+    return (!m_hash || !l->m_hash || m_hash == l->m_hash)
+      && forms_equal(begin(), end(), l->begin(), l->end());
+  }
+  if (auto l = dynamic_cast<const ListSlice*>(&f)) {
+    return l->equals(*this);
+  }
+  return false;
+}
+
+// A string is a view onto (part of) a shared, immutable character buffer, so
+// taking a substring doesn't copy
+struct String : public Form
+{
+  String(const string& s)
+    : m_storage(make_shared<string>())
+  {
+    unescape(s.cbegin()+1, s.cend()-1,
+             back_inserter(*m_storage));
+    m_size = m_storage->size();
+  }
+
+  // construct from an already unescaped value
+  struct Raw {};
+  String(Raw, string&& s)
+    : m_storage(make_shared<string>(std::move(s)))
+    , m_size(m_storage->size())
+  {}
+
+  String(const shared_ptr<string>& storage, size_t offset, size_t size)
+    : m_storage(storage)
+    , m_offset(offset)
+    , m_size(size)
+  {}
+
+  virtual string print() const
+  {
+    string s;
+    s.push_back('"');
+    escape(data(), data() + m_size,
+           back_inserter(s));
+    s.push_back('"');
+    return s;
+  }
+
+  // strings are immutable, so the hash is computed once on demand
+  virtual size_t hash() const
+  {
+    if (!m_hash) m_hash = hash_chars(data(), m_size) | 1;
+    return m_hash;
+  }
+
+  virtual bool equals(const Form& f) const
+  {
+    auto s = dynamic_cast<const String*>(&f);
+    return s && (s == this
+                 || (m_size == s->m_size && hash() == s->hash()
+                     && memcmp(data(), s->data(), m_size) == 0));
+  }
+
+  const char* data() const { return m_storage->data() + m_offset; }
+  size_t size() const { return m_size; }
+  string value() const { return string(data(), m_size); }
+
+  shared_ptr<string> m_storage;
+  size_t m_offset = 0;
+  size_t m_size = 0;
+  mutable size_t m_hash = 0;
+};
+
+struct Number : public Form
+{
+  Number(const string& s)
+  {
+    m_value = stoll(s);
+  }
+  Number(int64_t n) : m_value(n) {}
+
+  virtual string print() const
+  {
+    return to_string(m_value);
+  }
+
+  virtual size_t hash() const { return std::hash<int64_t>{}(m_value); }
+
+  virtual bool equals(const Form& f) const
+  {
+    auto n = dynamic_cast<const Number*>(&f);
+    return n && n->m_value == m_value;
+  }
+
+  int64_t m_value;
+};
+
+// Special forms are recognized by a tag that each symbol works out once,
+// when it is made, so that evaluating a list switches on it rather than
+// comparing the head's name against every special form in turn
+enum class SpecialForm : uint8_t
+{
+  none,
+  let,
+  if_,
+  lambda,
+  set,
+  quote,
+  begin,
+  defrecord,
+  defprotocol,
+  extend_type,
+  defmulti,
+  with_counters,
+  time,
+  bench
+};
+
+SpecialForm special_form(const string& s)
+{
+  static const unordered_map<string, SpecialForm> forms = {
+    { "let", SpecialForm::let },
+    { "if", SpecialForm::if_ },
+    { "lambda", SpecialForm::lambda },
+    { "set!", SpecialForm::set },
+    { "quote", SpecialForm::quote },
+    { "begin", SpecialForm::begin },
+    { "defrecord", SpecialForm::defrecord },
+    { "defprotocol", SpecialForm::defprotocol },
+    { "extend-type", SpecialForm::extend_type },
+    { "defmulti", SpecialForm::defmulti },
+    { "with-counters", SpecialForm::with_counters },
+    { "time", SpecialForm::time },
+    { "bench", SpecialForm::bench },
+  };
+  auto i = forms.find(s);
+  return i == forms.end() ? SpecialForm::none : i->second;
+}
+
+struct Symbol : public Form
+{
+  Symbol(const string& s)
+    : m_value(s)
+    , m_special(special_form(s))
+  {}
+  virtual string print() const { return m_value; }
+
+  virtual FormPtr eval(Environment& e)
+  {
+    // keywords evaluate to themselves
+    if (m_value[0] == ':') return shared_from_this();
+
+    auto f = e.lookup(m_value);
+    if (!f) {
+      cout << "Unbound symbol: " << m_value << at(*this) << endl;
+    }
+    return f;
+  }
+
+  virtual bool symb_eq(const string& s) { return s == m_value; }
+
+  virtual size_t hash() const
+  {
+    if (!m_hash) m_hash = std::hash<string>{}(m_value) | 1;
+    return m_hash;
+  }
+
+  virtual bool equals(const Form& f) const
+  {
+    auto s = dynamic_cast<const Symbol*>(&f);
+    return s && (s == this
+                 || (hash() == s->hash() && m_value == s->m_value));
+  }
+
+  string m_value;
+  SpecialForm m_special;
+  mutable size_t m_hash = 0;
+
+  // inline cache for map lookups by this symbol: each occurrence in the
+  // source is its own Symbol, so this caches per call site
+  mutable const void* m_ic_shape = nullptr;
+  mutable size_t m_ic_slot = 0;
+
+  // likewise for protocol and multimethod dispatch, when this symbol is
+  // the head of a call
+  mutable shared_ptr<DispatchCache> m_dispatch_cache;
+};
+
+struct Function : public Form
+{
+  Function(vector<string>&& params, const FormPtr& body)
+    : m_params(std::move(params))
+    , m_body(body)
+  {}
+
+  virtual string print() const { return "<function>"; }
+
+  virtual FormPtr apply(Environment &e) const
+  {
+    return m_body->eval(e);
+  }
+
+  vector<string> m_params;
+  FormPtr m_body;
+  // how many trailing params may be left out, to be bound to nil
+  size_t m_optional = 0;
+
+  // the name the function was first bound to or called by, for diagnostics
+  // and profiling; m_source is where its lambda was read
+  string m_name;
+  mutable uint32_t m_profile_id = 0;
+};
+
+struct BuiltinFunction : public Function
+{
+  BuiltinFunction(vector<string>&& params,
+                  function<FormPtr(Environment&)>&& f,
+                  size_t optional = 0)
+    : Function(std::move(params), nullptr)
+    , m_f(std::move(f))
+  {
+    m_optional = optional;
+  }
+
+  virtual string print() const { return "<builtin function>"; }
+
+  virtual FormPtr apply(Environment &e) const
+  {
+    return m_f(e);
+  }
+
+  function<FormPtr(Environment&)> m_f;
+};
+
+//------------------------------------------------------------------------------
+// Records: defrecord declares a type with named fields, stored in a fixed
+// array of slots. Each field gets an accessor bound to its slot index, so a
+// field read is a type check and an indexed load.
+
+struct RecordType
+{
+  string m_name;
+  vector<string> m_fields;
+};
+
+struct Record : public Form
+{
+  Record(const shared_ptr<const RecordType>& type, vector<FormPtr>&& slots)
+    : m_type(type)
+    , m_slots(std::move(slots))
+  {}
+
+  virtual string print() const
+  {
+    string s = "(" + m_type->m_name;
+    for (const auto& f : m_slots) {
+      s.push_back(' ');
+      s += f->print();
+    }
+    s.push_back(')');
+    return s;
+  }
+
+  // records are immutable, so the hash is computed once on demand
+  virtual size_t hash() const
+  {
+    if (!m_hash) {
+      m_hash = hash_combine(std::hash<const void*>{}(m_type.get()),
+                            hash_forms(m_slots.data(),
+                                       m_slots.data() + m_slots.size()));
+    }
+    return m_hash;
+  }
+
+  virtual bool equals(const Form& f) const
+  {
+    auto r = dynamic_cast<const Record*>(&f);
+    return r && r->m_type == m_type
+      && forms_equal(m_slots.data(), m_slots.data() + m_slots.size(),
+                     r->m_slots.data(), r->m_slots.data() + r->m_slots.size());
+  }
+
+  shared_ptr<const RecordType> m_type;
+  const vector<FormPtr> m_slots;
+  mutable size_t m_hash = 0;
+};
+
+struct RecordConstructor : public Function
+{
+  RecordConstructor(const shared_ptr<const RecordType>& type)
+    : Function(vector<string>(type->m_fields), nullptr)
+    , m_type(type)
+  {}
+
+  virtual string print() const { return "<record constructor>"; }
+
+  virtual FormPtr apply(Environment &e) const
+  {
+    vector<FormPtr> slots;
+    slots.reserve(m_params.size());
+    for (const auto& p : m_params) slots.push_back(e.lookup(p));
+    return make_form<Record>(m_type, std::move(slots));
+  }
+
+  shared_ptr<const RecordType> m_type;
+};
+
+struct RecordAccessor : public Function
+{
+  RecordAccessor(const shared_ptr<const RecordType>& type, size_t slot)
+    : Function(vector<string>{"r"}, nullptr)
+    , m_type(type)
+    , m_slot(slot)
+  {}
+
+  virtual string print() const { return "<record accessor>"; }
+
+  virtual FormPtr apply(Environment &e) const
+  {
+    return get(e.lookup("r"));
+  }
+
+  // an exact typeid match is much cheaper than a dynamic_cast
+  FormPtr get(const FormPtr& f) const
+  {
+    auto p = f.get();
+    if (p && typeid(*p) == typeid(Record)) {
+      auto r = static_cast<const Record*>(p);
+      if (r->m_type == m_type) return r->m_slots[m_slot];
+    }
+    cout << m_type->m_name << "-" << m_type->m_fields[m_slot]
+         << " expects a " << m_type->m_name << ", got "
+         << (p ? p->print() : "nothing") << endl;
+    return nullptr;
+  }
+
+  shared_ptr<const RecordType> m_type;
+  size_t m_slot;
+};
+
+//------------------------------------------------------------------------------
+// Small maps keyed by symbols use hidden classes. A Shape is an ordered set
+// of keys shared by every map built by adding the same keys in the same
+// order; the map itself is just its shape and a packed array of values.
+// Adding a key follows (or creates) a transition to the next shape.
+
+class Shape
+{
+public:
+  static constexpr size_t npos = ~size_t{};
+
+  static Shape* root()
+  {
+    static Shape s;
+    return &s;
+  }
+
+  size_t slot(const string& key) const
+  {
+    for (size_t i = 0; i < m_keys.size(); ++i) {
+      if (m_keys[i]->m_value == key) return i;
+    }
+    return npos;
+  }
+
+  // shapes live forever, so raw pointers to them are stable
+  Shape* with(const shared_ptr<Symbol>& key)
+  {
+    auto& next = m_transitions[key->m_value];
+    if (!next) {
+      next = unique_ptr<Shape>(new Shape);
+      next->m_keys = m_keys;
+      next->m_keys.push_back(key);
+    }
+    return next.get();
+  }
+
+  vector<shared_ptr<Symbol>> m_keys;
+
+private:
+  Shape() {}
+
+  map<string, unique_ptr<Shape>> m_transitions;
+};
+
+constexpr size_t Shape::npos;
+
+struct SmallMap : public Form
+{
+  SmallMap(Shape* shape, vector<FormPtr>&& values)
+    : m_shape(shape)
+    , m_values(std::move(values))
+  {}
+
+  virtual string print() const
+  {
+    string s;
+    s.push_back('{');
+    for (size_t i = 0; i < m_values.size(); ++i) {
+      if (i > 0) s.push_back(' ');
+      s += m_shape->m_keys[i]->print() + " " + m_values[i]->print();
+    }
+    s.push_back('}');
+    return s;
+  }
+
+  // the slot for key, checking the call site's cache first
+  size_t slot(const Symbol& key) const
+  {
+    if (key.m_ic_shape == m_shape) {
+      count(&ThreadMetrics::map_cache_hits);
+      return key.m_ic_slot;
+    }
+    count(&ThreadMetrics::map_cache_misses);
+    auto i = m_shape->slot(key.m_value);
+    key.m_ic_shape = m_shape;
+    key.m_ic_slot = i;
+    return i;
+  }
+
+  // maps with the same entries are equal whatever their shapes
+  virtual size_t hash() const
+  {
+    size_t h = 0x6d6170;
+    for (size_t i = 0; i < m_values.size(); ++i) {
+      h += hash_combine(m_shape->m_keys[i]->hash(), m_values[i]->hash());
+    }
+    return h;
+  }
+
+  virtual bool equals(const Form& f) const
+  {
+    auto m = dynamic_cast<const SmallMap*>(&f);
+    if (!m || m->m_values.size() != m_values.size()) return false;
+    for (size_t i = 0; i < m_values.size(); ++i) {
+      auto j = m->m_shape == m_shape
+        ? i : m->m_shape->slot(m_shape->m_keys[i]->m_value);
+      if (j == Shape::npos || !forms_equal(m_values[i], m->m_values[j])) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  Shape* m_shape;
+  vector<FormPtr> m_values;
+};
+
+FormPtr assoc(const SmallMap& m, const shared_ptr<Symbol>& key,
+              const FormPtr& value)
+{
+  auto values = m.m_values;
+  auto i = m.slot(*key);
+  if (i != Shape::npos) {
+    values[i] = value;
+    return make_form<SmallMap>(m.m_shape, std::move(values));
+  }
+  values.push_back(value);
+  return make_form<SmallMap>(m.m_shape->with(key), std::move(values));
+}
+
+//------------------------------------------------------------------------------
+// Protocols dispatch on the type of their first argument, multimethods on the
+// value of a dispatch function. Each method keeps a global table of
+// implementations; each call site keeps a small cache in front of it. Any
+// change to a table bumps the dispatch version, which invalidates every call
+// site cache at once.
+
+static uint64_t dispatch_version = 1;
+
+string type_name(const Form& f);
+string type_name(type_index t);
+const void* type_key(const Form& f);
+const void* dispatch_key(const Form& f);
+const void* type_key_by_name(const string& name, Environment& e);
+
+struct DispatchCache
+{
+  static constexpr size_t max_entries = 4;
+
+  struct Entry
+  {
+    const void* type;
+    FormPtr value;
+    shared_ptr<Function> impl;
+  };
+
+  // a hit matches the type (protocols) or the dispatch value (multimethods)
+  shared_ptr<Function> find(const void* type, const FormPtr& value)
+  {
+    if (m_version != dispatch_version) {
+      m_entries.clear();
+      m_megamorphic = false;
+      m_version = dispatch_version;
+    }
+    for (const auto& en : m_entries) {
+      if (en.type == type && forms_equal(en.value, value)) {
+        count(&ThreadMetrics::dispatch_cache_hits);
+        return en.impl;
+      }
+    }
+    count(&ThreadMetrics::dispatch_cache_misses);
+    return nullptr;
+  }
+
+  // a site that sees too many different types stops caching
+  void add(const void* type, const FormPtr& value,
+           const shared_ptr<Function>& impl)
+  {
+    if (m_megamorphic) return;
+    if (m_entries.size() == max_entries) {
+      m_entries.clear();
+      m_megamorphic = true;
+      return;
+    }
+    m_entries.push_back({type, value, impl});
+  }
+
+  const void* m_owner = nullptr;
+  uint64_t m_version = 0;
+  vector<Entry> m_entries;
+  bool m_megamorphic = false;
+};
+
+constexpr size_t DispatchCache::max_entries;
+
+struct Dispatcher : public Function
+{
+  Dispatcher(vector<string>&& params, string&& name)
+    : Function(std::move(params), nullptr)
+  {
+    m_name = std::move(name);
+  }
+
+  // apply to evaluated arguments, through the call site's cache if any
+  virtual FormPtr dispatch(const vector<FormPtr>& args, Environment& e,
+                           DispatchCache* cache) const = 0;
+
+  virtual FormPtr apply(Environment& e) const
+  {
+    vector<FormPtr> args;
+    for (const auto& p : m_params) args.push_back(e.lookup(p));
+    return dispatch(args, e, nullptr);
+  }
+};
+
+struct ProtocolMethod : public Dispatcher
+{
+  ProtocolMethod(vector<string>&& params, string&& name, string&& protocol)
+    : Dispatcher(std::move(params), std::move(name))
+    , m_protocol(std::move(protocol))
+  {}
+
+  virtual string print() const { return "<protocol method " + m_name + ">"; }
+
+  virtual FormPtr dispatch(const vector<FormPtr>& args, Environment& e,
+                           DispatchCache* cache) const
+  {
+    // the call site matches on the exact type; only a miss needs the type
+    // key that same-named types share
+    auto key = dispatch_key(*args[0]);
+    auto impl = cache ? cache->find(key, nullptr) : nullptr;
+    if (!impl) {
+      auto i = m_impls.find(type_key(*args[0]));
+      if (i == m_impls.end()) {
+        cout << "No implementation of " << m_name << " for "
+             << type_name(*args[0]) << endl;
+        return nullptr;
+      }
+      impl = i->second;
+      if (cache) cache->add(key, nullptr, impl);
+    }
+    return call(*impl, args, e);
+  }
+
+  string m_protocol;
+  unordered_map<const void*, shared_ptr<Function>> m_impls;
+};
+
+struct FormHash
+{
+  size_t operator()(const FormPtr& f) const { return f->hash(); }
+};
+
+struct FormEqual
+{
+  bool operator()(const FormPtr& a, const FormPtr& b) const
+  {
+    return forms_equal(a, b);
+  }
+};
+
+struct MultiFn : public Dispatcher
+{
+  MultiFn(string&& name, const shared_ptr<Function>& dispatch_fn)
+    : Dispatcher(vector<string>(dispatch_fn->m_params), std::move(name))
+    , m_dispatch_fn(dispatch_fn)
+  {}
+
+  virtual string print() const { return "<multimethod " + m_name + ">"; }
+
+  virtual FormPtr dispatch(const vector<FormPtr>& args, Environment& e,
+                           DispatchCache* cache) const
+  {
+    auto value = call(*m_dispatch_fn, args, e);
+    if (!value) return nullptr;
+
+    auto impl = cache ? cache->find(nullptr, value) : nullptr;
+    if (!impl) {
+      auto i = m_methods.find(value);
+      impl = i == m_methods.end() ? m_default : i->second;
+      if (!impl) {
+        cout << "No method of " << m_name << " for " << value->print() << endl;
+        return nullptr;
+      }
+      if (cache) cache->add(nullptr, value, impl);
+    }
+    return call(*impl, args, e);
+  }
+
+  shared_ptr<Function> m_dispatch_fn;
+  unordered_map<FormPtr, shared_ptr<Function>, FormHash, FormEqual> m_methods;
+  shared_ptr<Function> m_default;
+};
+
+//------------------------------------------------------------------------------
+// Interned strings: string columns store 32-bit ids into this pool
+
+class StringPool
+{
+public:
+  uint32_t intern(const char* p, size_t n)
+  {
+    string s(p, n);
+    auto i = m_ids.find(s);
+    if (i != m_ids.end()) return i->second;
+    auto id = static_cast<uint32_t>(m_strings.size());
+    m_strings.push_back(s);
+    m_ids.emplace(std::move(s), id);
+    return id;
+  }
+
+  const string& lookup(uint32_t id) const { return m_strings[id]; }
+
+private:
+  vector<string> m_strings;
+  unordered_map<string, uint32_t> m_ids;
+};
+
+StringPool& string_pool()
+{
+  static StringPool pool;
+  return pool;
+}
+
+//------------------------------------------------------------------------------
+// A named, typed column of unboxed values
+
+struct Column : public Form
+{
+  enum class Type { I64, Str };
+
+  Column(string&& name, Type t)
+    : m_name(std::move(name))
+    , m_type(t)
+  {}
+
+  virtual string print() const
+  {
+    return "<column " + m_name
+      + (m_type == Type::I64 ? " i64[" : " str[")
+      + to_string(size()) + "]>";
+  }
+
+  size_t size() const
+  {
+    return m_type == Type::I64 ? m_i64.size() : m_str.size();
+  }
+
+  // box a single element
+  FormPtr at(size_t i) const
+  {
+    if (m_type == Type::I64) {
+      return make_form<Number>(m_i64[i]);
+    }
+    return make_form<String>(String::Raw{},
+                               string(string_pool().lookup(m_str[i])));
+  }
+
+  // columns are immutable once built, so the hash is computed once on demand
+  virtual size_t hash() const
+  {
+    if (!m_hash) {
+      m_hash = m_type == Type::I64
+        ? hash_chars(reinterpret_cast<const char*>(m_i64.data()),
+                     m_i64.size() * sizeof(int64_t))
+        : hash_chars(reinterpret_cast<const char*>(m_str.data()),
+                     m_str.size() * sizeof(uint32_t));
+      m_hash |= 1;
+    }
+    return m_hash;
+  }
+
+  // same name, type and contents; interned strings compare by id
+  virtual bool equals(const Form& f) const
+  {
+    auto c = dynamic_cast<const Column*>(&f);
+    if (!c) return false;
+    if (c == this) return true;
+    if (c->m_type != m_type || c->size() != size()
+        || (m_hash && c->m_hash && m_hash != c->m_hash)
+        || c->m_name != m_name) {
+      return false;
+    }
+    return m_type == Type::I64
+      ? memcmp(m_i64.data(), c->m_i64.data(), size() * sizeof(int64_t)) == 0
+      : memcmp(m_str.data(), c->m_str.data(), size() * sizeof(uint32_t)) == 0;
+  }
+
+  string m_name;
+  Type m_type;
+  vector<int64_t> m_i64;
+  vector<uint32_t> m_str;
+  mutable size_t m_hash = 0;
+};
+
+using ColumnPtr = shared_ptr<Column>;
+
+//------------------------------------------------------------------------------
+// A table is a set of equal-length named columns
+
+struct Table : public Form
+{
+  Table(vector<ColumnPtr>&& columns) : m_columns(std::move(columns)) {}
+
+  virtual string print() const
+  {
+    string s = "<table " + to_string(rows()) + " rows:";
+    for (const auto& c : m_columns) {
+      s.push_back(' ');
+      s += c->m_name;
+    }
+    s.push_back('>');
+    return s;
+  }
+
+  size_t rows() const
+  {
+    return m_columns.empty() ? 0 : m_columns.front()->size();
+  }
+
+  virtual size_t hash() const
+  {
+    size_t h = 0x7461626c65;
+    for (const auto& c : m_columns) h = hash_combine(h, c->hash());
+    return h;
+  }
+
+  virtual bool equals(const Form& f) const
+  {
+    auto t = dynamic_cast<const Table*>(&f);
+    return t && (t == this
+                 || equal(m_columns.cbegin(), m_columns.cend(),
+                          t->m_columns.cbegin(), t->m_columns.cend(),
+                          [] (const ColumnPtr& a, const ColumnPtr& b) {
+                            return a->equals(*b);
+                          }));
+  }
+
+  ColumnPtr find(const string& name) const
+  {
+    auto i = find_if(m_columns.cbegin(), m_columns.cend(),
+                     [&] (const auto& c) { return c->m_name == name; });
+    return i == m_columns.cend() ? nullptr : *i;
+  }
+
+  vector<ColumnPtr> m_columns;
+};
+
+// The result of group-by: a group number for every row of the source table,
+// ready to feed the aggregation kernels
+struct Grouping : public Form
+{
+  virtual string print() const
+  {
+    return "<grouping " + m_key->m_name + " "
+      + to_string(m_first_rows.size()) + " groups>";
+  }
+
+  shared_ptr<Table> m_table;
+  ColumnPtr m_key;
+  vector<uint32_t> m_group_of_row;
+  vector<size_t> m_first_rows;
+};
+
+//------------------------------------------------------------------------------
+
+// Coverage. While it is on, the reader gives each list it reads an id, and
+// evaluation counts into a plain array indexed by that id, so counting an
+// evaluation is an increment with no lookup. An if form also gets a pair of
+// branch counters. Sites record where each id was read, for the report.
+namespace
+{
+  bool coverage_on = false;
+
+  struct CoverageSite
+  {
+    uint32_t source;
+    size_t branch;
+  };
+  constexpr size_t no_branch = static_cast<size_t>(-1);
+
+  // id 0 is reserved for lists read while coverage was off
+  vector<CoverageSite> coverage_sites = {{0, no_branch}};
+  vector<uint64_t> coverage_counts = {0};
+
+  // a deque, so that counters stay put while a branch is being evaluated
+  deque<array<uint64_t, 2>> branch_counts;
+
+  uint32_t coverage_site(uint32_t source, const vector<FormPtr>& v)
+  {
+    auto branch = no_branch;
+    if (v.front() && v.front()->symb_eq("if")) {
+      branch = branch_counts.size();
+      branch_counts.push_back({{0, 0}});
+    }
+    coverage_sites.push_back({source, branch});
+    coverage_counts.push_back(0);
+    return static_cast<uint32_t>(coverage_sites.size() - 1);
+  }
+}
+
+FormPtr read_form(Reader& r);
+
+FormPtr read_list(Reader& r)
+{
+  vector<FormPtr> v;
+
+  auto source = r.source();
+  auto where = [source] {
+    return source ? " at " + to_string(source_location(source)) : string();
+  };
+  r.next(); // skip open paren
+  if (r.empty()) {
+    cout << "Error: unterminated read (list)" << where() << endl;
+    return nullptr;
+  }
+
+  while (r.peek()[0] != ')')
+  {
+    v.emplace_back(read_form(r));
+    if (r.empty()) {
+      cout << "Error: unterminated read (list)" << where() << endl;
+      return nullptr;
+    }
+  }
+  r.next(); // eat close paren
+
+  if (v.empty())
+  {
+    return make_form<Nil>();
+  }
+  auto l = make_form<List>(std::move(v));
+  if (coverage_on) {
+    l->m_coverage_id = coverage_site(source, l->m_elements);
+  }
+  return l;
+}
+
+FormPtr read_atom(Reader& r)
+{
+  auto t = r.next();
+
+  if (t[0] == '"') {
+    return make_form<String>(std::move(t));
+  }
+  if (isdigit(t[0])) {
+    return make_form<Number>(std::move(t));
+  }
+  if (t == "true") {
+    return make_form<True>();
+  }
+  if (t == "false") {
+    return make_form<False>();
+  }
+  if (t[0] == ';') {
+    return nullptr;
+  }
+  return make_form<Symbol>(std::move(t));
+}
+
+FormPtr read_form(Reader& r)
+{
+  if (r.empty()) return nullptr;
+
+  auto source = r.source();
+  FormPtr f;
+  auto t = r.peek();
+  switch (t[0])
+  {
+    case '(':
+      f = read_list(r);
+      break;
+    default:
+      f = read_atom(r);
+      break;
+  }
+  if (f) f->m_source = source;
+  return f;
+}
+
+// text read without a source file, as by the debugger, gets no source ids
+FormPtr read(const string& s)
+{
+  auto t = tokenizer(s);
+  auto r = Reader(std::move(t));
+  return read_form(r);
+}
+
+FormPtr read(const string& s, uint32_t file, uint32_t line)
+{
+  vector<uint32_t> offsets;
+  auto t = tokenize(s, &offsets);
+  auto base = source_chunk(s, file, line);
+  auto r = Reader(std::move(t), std::move(offsets), base);
+  return read_form(r);
+}
+
+//------------------------------------------------------------------------------
+// Profilers. Every function application opens a ProfileFrame, which does
+// nothing unless one of the profiling modes is on.
+//
+// Sampling: each frame pushes the function's name id onto a shadow stack. On
+// each SIGPROF the handler copies the shadow stack into a preallocated
+// buffer; the samples are folded into collapsed stacks when profiling stops.
+//
+// Counting: each frame records the call and its inclusive and exclusive
+// ticks and form allocations, reported by (profile-report).
+//
+// Allocations: the allocation hook attributes each form and environment to
+// its type and to the function on top of the shadow stack, and keeps the
+// whole stack for one in every N; reported by (allocation-report).
+//
+// Tracing: each frame writes enter and exit events into a ring buffer owned
+// by the current thread, along with spans for other work (regex compilation,
+// parallel sort chunks) and a running count of forms created. The buffers are
+// written out as Chrome trace-event JSON when tracing stops.
+//
+// Perf map: each named function is applied through its own copy of a tiny
+// machine code trampoline, listed under the function's name in
+// /tmp/perf-<pid>.map, so that perf attributes native samples to the Lisp
+// functions on the stack.
+
+atomic<uint64_t> forms_created{0};
+atomic<uint64_t> forms_destroyed{0};
+unsigned form_counters = 0;
+void (*allocation_hook)(const type_info&, size_t) = nullptr;
+
+namespace
+{
+  constexpr size_t max_shadow_depth = 1024;
+  constexpr size_t sample_buffer_size = 1 << 22;
+
+  enum ProfileMode : unsigned
+  {
+    sampling = 1,
+    counting = 2,
+    allocations = 4,
+    tracing = 8,
+    perf_map = 16
+  };
+  unsigned profile_mode = 0;
+
+  array<uint32_t, max_shadow_depth> shadow_stack;
+  atomic<size_t> shadow_depth{0};
+
+  // per sample: the depth, then that many frame ids, outermost first
+  vector<uint32_t> samples;
+  atomic<size_t> samples_end{0};
+  atomic<size_t> samples_dropped{0};
+
+  // id 0 is every function that was never named; the next few name the
+  // spans that tracing records for work other than function calls, and
+  // allocations made outside any function
+  enum : uint32_t
+  {
+    anonymous_id,
+    regex_compile_id,
+    sort_chunk_id,
+    sort_merge_id,
+    csv_chunk_id,
+    forms_id,
+    top_level_id
+  };
+  vector<string> profile_names =
+    { "<anonymous>", "regex compile", "sort chunk", "sort merge", "csv chunk",
+      "forms", "<top level>" };
+  unordered_map<string, uint32_t> profile_ids;
+
+  // functions are profiled by name, or by where an unnamed lambda was read
+  uint32_t profile_id(const Function& f)
+  {
+    if (!f.m_profile_id && (!f.m_name.empty() || f.m_source)) {
+      auto name = f.m_name.empty()
+        ? "lambda@" + to_string(source_location(f.m_source)) : f.m_name;
+      auto i = profile_ids.find(name);
+      if (i == profile_ids.end()) {
+        i = profile_ids.emplace(name, profile_names.size()).first;
+        profile_names.push_back(name);
+      }
+      f.m_profile_id = i->second;
+    }
+    return f.m_profile_id;
+  }
+
+  // runs in signal context: touches only atomics and preallocated storage
+  void on_sigprof(int)
+  {
+    auto depth = min(shadow_depth.load(memory_order_relaxed), max_shadow_depth);
+    auto pos = samples_end.fetch_add(depth + 1, memory_order_relaxed);
+    if (pos + depth + 1 > samples.size()) {
+      samples_dropped.fetch_add(1, memory_order_relaxed);
+      return;
+    }
+    atomic_signal_fence(memory_order_acquire);
+    samples[pos] = static_cast<uint32_t>(depth);
+    copy_n(shadow_stack.cbegin(), depth, samples.begin() + pos + 1);
+  }
+
+  // the time stamp counter where there is one
+  uint64_t ticks()
+  {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return static_cast<uint64_t>(
+      chrono::steady_clock::now().time_since_epoch().count());
+#endif
+  }
+
+  struct CallStats
+  {
+    uint64_t calls = 0;
+    uint64_t inclusive = 0;
+    uint64_t exclusive = 0;
+    uint64_t allocations = 0;
+    uint32_t active = 0; // recursion depth, so inclusive time counts once
+  };
+
+  struct CallRecord
+  {
+    uint32_t id;
+    uint64_t start;
+    uint64_t start_forms;
+    uint64_t child_ticks = 0;
+    uint64_t child_forms = 0;
+  };
+
+  // indexed by profile id
+  vector<CallStats> call_stats;
+  vector<CallRecord> call_stack;
+  // bumped each time counting starts, so that frames from an earlier
+  // session leave without touching this one's records
+  uint32_t counting_session = 0;
+
+  // for converting ticks to time in the report
+  uint64_t counting_start_ticks;
+  chrono::steady_clock::time_point counting_start_time;
+
+  void enter_call(uint32_t id)
+  {
+    if (id >= call_stats.size()) call_stats.resize(id + 1);
+    ++call_stats[id].calls;
+    ++call_stats[id].active;
+    call_stack.push_back({id, ticks(), forms_created});
+  }
+
+  void leave_call()
+  {
+    auto r = call_stack.back();
+    call_stack.pop_back();
+    auto elapsed = ticks() - r.start;
+    auto forms = forms_created - r.start_forms;
+
+    auto& st = call_stats[r.id];
+    if (--st.active == 0) st.inclusive += elapsed;
+    st.exclusive += elapsed - r.child_ticks;
+    st.allocations += forms - r.child_forms;
+    if (!call_stack.empty()) {
+      call_stack.back().child_ticks += elapsed;
+      call_stack.back().child_forms += forms;
+    }
+  }
+
+  struct AllocationStats
+  {
+    uint64_t count = 0;
+    uint64_t bytes = 0;
+  };
+
+  struct AllocationSite
+  {
+    type_index type;
+    uint32_t source; // of the innermost list being evaluated
+    uint32_t function;
+
+    bool operator<(const AllocationSite& s) const
+    {
+      return tie(type, source, function) < tie(s.type, s.source, s.function);
+    }
+  };
+
+  map<AllocationSite, AllocationStats> allocation_sites;
+  map<vector<uint32_t>, AllocationStats> allocation_stacks;
+  unsigned allocation_period = 0;
+  unsigned allocation_countdown = 0;
+
+  // while the profiler is on, lists evaluate through allocation_eval_list,
+  // which keeps the source id of the innermost one that has a source
+  uint32_t allocation_source = 0;
+  ListEvaluator allocation_next = nullptr;
+
+  FormPtr allocation_eval_list(const List& l, Environment& e)
+  {
+    auto outer = allocation_source;
+    if (l.m_source) allocation_source = l.m_source;
+    auto result = allocation_next(l, e);
+    allocation_source = outer;
+    return result;
+  }
+
+  void note_allocation(const type_info& t, size_t size)
+  {
+    auto depth = min(shadow_depth.load(memory_order_relaxed), max_shadow_depth);
+    auto id = depth ? shadow_stack[depth - 1] : uint32_t{top_level_id};
+    auto& site = allocation_sites[{type_index(t), allocation_source, id}];
+    ++site.count;
+    site.bytes += size;
+
+    if (--allocation_countdown == 0) {
+      allocation_countdown = allocation_period;
+      auto& st = allocation_stacks[vector<uint32_t>(
+          shadow_stack.cbegin(), shadow_stack.cbegin() + depth)];
+      st.count += allocation_period;
+      st.bytes += size * allocation_period;
+    }
+  }
+}
+
+namespace
+{
+  enum class TraceKind : uint32_t
+  {
+    begin,
+    end,
+    counter
+  };
+
+  struct TraceEvent
+  {
+    uint64_t ticks;
+    uint64_t value; // counters only
+    uint32_t name;
+    TraceKind kind;
+  };
+
+  // once full, each ring overwrites its oldest events
+  constexpr size_t trace_ring_size = 1 << 16;
+  constexpr uint64_t trace_forms_interval = 4096;
+
+  struct TraceRing
+  {
+    array<TraceEvent, trace_ring_size> m_events;
+    uint64_t m_next = 0;
+    uint32_t m_tid = 0;
+  };
+
+  // rings outlive their threads, and are reused by later threads so that
+  // short-lived workers do not each cost a ring
+  mutex trace_mutex;
+  vector<unique_ptr<TraceRing>> trace_rings;
+  vector<TraceRing*> free_trace_rings;
+
+  struct TraceRingHolder
+  {
+    ~TraceRingHolder()
+    {
+      if (!m_ring) return;
+      lock_guard<mutex> lock(trace_mutex);
+      free_trace_rings.push_back(m_ring);
+    }
+    TraceRing* m_ring = nullptr;
+  };
+  thread_local TraceRingHolder trace_ring;
+
+  uint64_t trace_start_ticks;
+  chrono::steady_clock::time_point trace_start_time;
+  uint64_t trace_forms_mark;
+
+  TraceRing& this_thread_ring()
+  {
+    if (!trace_ring.m_ring) {
+      lock_guard<mutex> lock(trace_mutex);
+      if (!free_trace_rings.empty()) {
+        trace_ring.m_ring = free_trace_rings.back();
+        free_trace_rings.pop_back();
+      } else {
+        trace_rings.push_back(make_unique<TraceRing>());
+        trace_ring.m_ring = trace_rings.back().get();
+        trace_ring.m_ring->m_tid = static_cast<uint32_t>(trace_rings.size());
+      }
+    }
+    return *trace_ring.m_ring;
+  }
+
+  // the buffer belongs to this thread, so writing needs no synchronization
+  void trace(TraceKind kind, uint32_t name, uint64_t value = 0)
+  {
+    auto& r = this_thread_ring();
+    r.m_events[r.m_next++ % trace_ring_size] = { ticks(), value, name, kind };
+  }
+}
+
+// Keeps forms counted while it lives
+struct FormCounting
+{
+  FormCounting() { ++form_counters; }
+  ~FormCounting() { --form_counters; }
+
+  FormCounting(const FormCounting&) = delete;
+  FormCounting& operator=(const FormCounting&) = delete;
+};
+
+// Records a function application with whichever profilers are on; when none
+// is, it costs one branch
+struct ProfileFrame
+{
+  ProfileFrame(const Function& f)
+    : m_mode(profile_mode)
+  {
+    if (!m_mode) return;
+    m_id = profile_id(f);
+    m_session = counting_session;
+    if (m_mode & (sampling | allocations)) {
+      auto depth = shadow_depth.load(memory_order_relaxed);
+      if (depth < max_shadow_depth) shadow_stack[depth] = m_id;
+      atomic_signal_fence(memory_order_release);
+      shadow_depth.store(depth + 1, memory_order_relaxed);
+    }
+    if (m_mode & counting) enter_call(m_id);
+    if (m_mode & tracing) trace(TraceKind::begin, m_id);
+  }
+
+  ~ProfileFrame()
+  {
+    if (!m_mode) return;
+    if (m_mode & tracing) {
+      trace(TraceKind::end, m_id);
+      if (forms_created - trace_forms_mark >= trace_forms_interval) {
+        trace_forms_mark = forms_created;
+        trace(TraceKind::counter, forms_id, forms_created);
+      }
+    }
+    // a frame entered before profiling restarted has no record left
+    if ((m_mode & counting) && m_session == counting_session) leave_call();
+    if (m_mode & (sampling | allocations)) {
+      shadow_depth.fetch_sub(1, memory_order_relaxed);
+    }
+  }
+
+  ProfileFrame(const ProfileFrame&) = delete;
+  ProfileFrame& operator=(const ProfileFrame&) = delete;
+
+  unsigned m_mode;
+  uint32_t m_id = 0;
+  uint32_t m_session = 0;
+};
+
+// Traces a span of work other than a function call, on any thread
+struct TraceScope
+{
+  TraceScope(uint32_t name)
+    : m_active(profile_mode & tracing)
+    , m_name(name)
+  {
+    if (m_active) trace(TraceKind::begin, m_name);
+  }
+
+  ~TraceScope()
+  {
+    if (m_active) trace(TraceKind::end, m_name);
+  }
+
+  TraceScope(const TraceScope&) = delete;
+  TraceScope& operator=(const TraceScope&) = delete;
+
+  bool m_active;
+  uint32_t m_name;
+};
+
+void trace_start()
+{
+  lock_guard<mutex> lock(trace_mutex);
+  for (auto& r : trace_rings) r->m_next = 0;
+  trace_start_ticks = ticks();
+  trace_start_time = chrono::steady_clock::now();
+  trace_forms_mark = forms_created;
+  if (!(profile_mode & tracing)) ++form_counters;
+  profile_mode |= tracing;
+}
+
+void trace_stop(ostream& os)
+{
+  if (!(profile_mode & tracing)) return;
+  profile_mode &= ~tracing;
+  --form_counters;
+
+  auto elapsed = chrono::duration<double, micro>(
+    chrono::steady_clock::now() - trace_start_time).count();
+  auto elapsed_ticks = ticks() - trace_start_ticks;
+  auto us_per_tick = elapsed_ticks ? elapsed / elapsed_ticks : 0.0;
+
+  static const char* phases[] = { "B", "E", "C" };
+  lock_guard<mutex> lock(trace_mutex);
+  os << "{\"traceEvents\":[";
+  const char* sep = "\n";
+  os << fixed << setprecision(3);
+  for (const auto& r : trace_rings) {
+    auto first = r->m_next > trace_ring_size ? r->m_next - trace_ring_size : 0;
+    for (auto i = first; i < r->m_next; ++i) {
+      const auto& ev = r->m_events[i % trace_ring_size];
+      string name;
+      const auto& n = profile_names[ev.name];
+      escape(n.cbegin(), n.cend(), back_inserter(name));
+      os << sep << "{\"name\":\"" << name
+         << "\",\"ph\":\"" << phases[static_cast<uint32_t>(ev.kind)]
+         << "\",\"ts\":" << (ev.ticks - trace_start_ticks) * us_per_tick
+         << ",\"pid\":1,\"tid\":" << r->m_tid;
+      if (ev.kind == TraceKind::counter) {
+        os << ",\"args\":{\"" << name << "\":" << ev.value << "}";
+      }
+      os << "}";
+      sep = ",\n";
+    }
+  }
+  os << "\n]}\n";
+  os.flags(ios::fmtflags{});
+}
+
+namespace
+{
+  using Thunk = void (*)(const Function*, Environment*, FormPtr*);
+  using Trampoline = void (*)(const Function*, Environment*, FormPtr*, Thunk);
+
+  void apply_thunk(const Function* f, Environment* e, FormPtr* result)
+  {
+    *result = f->apply(*e);
+  }
+
+  // trampolines by profile id, created on first use
+  vector<Trampoline> trampolines;
+
+#if defined(__linux__) && defined(__x86_64__)
+  // push rbp; mov rbp, rsp; call rcx; pop rbp; ret: calls the thunk (the
+  // fourth argument) with the first three, in a frame of its own
+  constexpr array<uint8_t, 8> trampoline_code =
+    {{ 0x55, 0x48, 0x89, 0xe5, 0xff, 0xd1, 0x5d, 0xc3 }};
+  constexpr size_t trampoline_size = 16;
+
+  uint8_t* trampoline_page = nullptr;
+  size_t trampoline_page_size = 0;
+  size_t trampoline_page_used = 0;
+  ofstream perf_map_file;
+
+  Trampoline make_trampoline(uint32_t id)
+  {
+    if (!trampoline_page
+        || trampoline_page_used + trampoline_size > trampoline_page_size) {
+      trampoline_page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+      auto p = mmap(nullptr, trampoline_page_size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (p == MAP_FAILED) return nullptr;
+      trampoline_page = static_cast<uint8_t*>(p);
+      trampoline_page_used = 0;
+    } else if (mprotect(trampoline_page, trampoline_page_size,
+                        PROT_READ | PROT_WRITE) != 0) {
+      return nullptr;
+    }
+
+    auto code = trampoline_page + trampoline_page_used;
+    copy(trampoline_code.cbegin(), trampoline_code.cend(), code);
+    trampoline_page_used += trampoline_size;
+    if (mprotect(trampoline_page, trampoline_page_size,
+                 PROT_READ | PROT_EXEC) != 0) {
+      return nullptr;
+    }
+
+    perf_map_file << hex << reinterpret_cast<uintptr_t>(code) << ' '
+                  << trampoline_size << dec << " blisp:" << profile_names[id]
+                  << endl;
+    return reinterpret_cast<Trampoline>(code);
+  }
+#else
+  Trampoline make_trampoline(uint32_t)
+  {
+    return nullptr;
+  }
+#endif
+}
+
+bool perf_map_start()
+{
+#if defined(__linux__) && defined(__x86_64__)
+  perf_map_file.open("/tmp/perf-" + to_string(getpid()) + ".map");
+  if (!perf_map_file) {
+    cout << "Could not open the perf map file" << endl;
+    return false;
+  }
+  profile_mode |= perf_map;
+  return true;
+#else
+  cout << "Perf maps are only supported on x86-64 Linux" << endl;
+  return false;
+#endif
+}
+
+// apply a function whose arguments are bound, through its trampoline when
+// writing a perf map
+FormPtr invoke(const Function& f, Environment& e)
+{
+  count(&ThreadMetrics::calls);
+  if (!(profile_mode & perf_map)) return f.apply(e);
+
+  auto id = profile_id(f);
+  if (id >= trampolines.size()) trampolines.resize(id + 1);
+  if (!trampolines[id]) trampolines[id] = make_trampoline(id);
+  if (!trampolines[id]) return f.apply(e);
+
+  FormPtr result;
+  trampolines[id](&f, &e, &result, apply_thunk);
+  return result;
+}
+
+//------------------------------------------------------------------------------
+// Hardware performance counters for the calling thread, where the kernel
+// allows them; in containers and on other platforms they fail to open.
+
+namespace
+{
+  struct CounterSpec
+  {
+    const char* name;
+    uint32_t type;
+    uint64_t config;
+  };
+
+#if defined(__linux__)
+  const array<CounterSpec, 6> counter_specs = {{
+    { ":cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { ":instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { ":cache-references", PERF_TYPE_HARDWARE,
+      PERF_COUNT_HW_CACHE_REFERENCES },
+    { ":cache-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    { ":branches", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS },
+    { ":branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+  }};
+#else
+  const array<CounterSpec, 6> counter_specs = {{
+    { ":cycles", 0, 0 },
+    { ":instructions", 0, 0 },
+    { ":cache-references", 0, 0 },
+    { ":cache-misses", 0, 0 },
+    { ":branches", 0, 0 },
+    { ":branch-misses", 0, 0 },
+  }};
+#endif
+
+  const CounterSpec* find_counter(const string& name)
+  {
+    auto i = find_if(counter_specs.cbegin(), counter_specs.cend(),
+                     [&] (const CounterSpec& c) { return name == c.name; });
+    return i == counter_specs.cend() ? nullptr : &*i;
+  }
+}
+
+class HardwareCounter
+{
+public:
+  HardwareCounter(const CounterSpec& spec)
+  {
+#if defined(__linux__)
+    perf_event_attr attr{};
+    attr.size = sizeof(attr);
+    attr.type = spec.type;
+    attr.config = spec.config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    m_fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+#else
+    (void)spec;
+#endif
+  }
+
+  ~HardwareCounter()
+  {
+#if defined(__linux__)
+    if (m_fd >= 0) close(m_fd);
+#endif
+  }
+
+  HardwareCounter(const HardwareCounter&) = delete;
+  HardwareCounter& operator=(const HardwareCounter&) = delete;
+
+  bool valid() const { return m_fd >= 0; }
+
+  void start()
+  {
+#if defined(__linux__)
+    if (!valid()) return;
+    ioctl(m_fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(m_fd, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+  }
+
+  // false if the counter could not be read
+  bool stop(uint64_t& count)
+  {
+#if defined(__linux__)
+    if (!valid()) return false;
+    ioctl(m_fd, PERF_EVENT_IOC_DISABLE, 0);
+    return read(m_fd, &count, sizeof(count)) == sizeof(count);
+#else
+    (void)count;
+    return false;
+#endif
+  }
+
+private:
+  int m_fd = -1;
+};
+
+//------------------------------------------------------------------------------
+// Metrics endpoint: a background thread answers each connection on a Unix
+// socket with the current counters in Prometheus text exposition format, as
+// an HTTP response so that a scraper can reach it through a proxy.
+
+namespace
+{
+  int metrics_fd = -1;
+  string metrics_path;
+  thread metrics_thread;
+  chrono::steady_clock::time_point metrics_start_time;
+
+  string metrics_text()
+  {
+    uint64_t evaluations = 0, calls = 0;
+    uint64_t map_hits = 0, map_misses = 0;
+    uint64_t dispatch_hits = 0, dispatch_misses = 0;
+    size_t threads = 0;
+    {
+      lock_guard<mutex> lock(metrics_mutex);
+      threads = all_thread_metrics.size();
+      for (const auto& m : all_thread_metrics) {
+        evaluations += m->evaluations.load(memory_order_relaxed);
+        calls += m->calls.load(memory_order_relaxed);
+        map_hits += m->map_cache_hits.load(memory_order_relaxed);
+        map_misses += m->map_cache_misses.load(memory_order_relaxed);
+        dispatch_hits += m->dispatch_cache_hits.load(memory_order_relaxed);
+        dispatch_misses += m->dispatch_cache_misses.load(memory_order_relaxed);
+      }
+    }
+    auto created = forms_created.load(memory_order_relaxed);
+    auto destroyed = forms_destroyed.load(memory_order_relaxed);
+
+    ostringstream os;
+    auto metric = [&] (const char* name, const char* type, const char* help) {
+      os << "# HELP " << name << ' ' << help << '\n'
+         << "# TYPE " << name << ' ' << type << '\n';
+    };
+    metric("blisp_evaluations_total", "counter", "Lists evaluated.");
+    os << "blisp_evaluations_total " << evaluations << '\n';
+    metric("blisp_calls_total", "counter", "Functions applied.");
+    os << "blisp_calls_total " << calls << '\n';
+    metric("blisp_forms_created_total", "counter", "Forms allocated.");
+    os << "blisp_forms_created_total " << created << '\n';
+    metric("blisp_live_forms", "gauge",
+           "Forms allocated since metrics started and not yet freed.");
+    os << "blisp_live_forms " << created - destroyed << '\n';
+    metric("blisp_inline_cache_lookups_total", "counter",
+           "Inline cache lookups by cache and result.");
+    os << "blisp_inline_cache_lookups_total{cache=\"map\",result=\"hit\"} "
+       << map_hits << '\n'
+       << "blisp_inline_cache_lookups_total{cache=\"map\",result=\"miss\"} "
+       << map_misses << '\n'
+       << "blisp_inline_cache_lookups_total"
+       << "{cache=\"dispatch\",result=\"hit\"} " << dispatch_hits << '\n'
+       << "blisp_inline_cache_lookups_total"
+       << "{cache=\"dispatch\",result=\"miss\"} " << dispatch_misses << '\n';
+    metric("blisp_counting_threads", "gauge", "Threads that have counted.");
+    os << "blisp_counting_threads " << threads << '\n';
+    metric("blisp_uptime_seconds", "gauge", "Seconds since metrics started.");
+    os << "blisp_uptime_seconds " << chrono::duration<double>(
+      chrono::steady_clock::now() - metrics_start_time).count() << '\n';
+    return os.str();
+  }
+
+#if !defined(_WIN32)
+  void serve_metrics(int fd)
+  {
+    while (true) {
+      int client = accept(fd, nullptr, nullptr);
+      if (client < 0) {
+        if (errno == EINTR) continue;
+        return; // closed by metrics_stop
+      }
+
+      // drain the request, if the client sends one promptly
+      pollfd p = { client, POLLIN, 0 };
+      if (poll(&p, 1, 100) > 0) {
+        char buf[1024];
+        while (recv(client, buf, sizeof(buf), MSG_DONTWAIT) == sizeof(buf)) {}
+      }
+
+      auto body = metrics_text();
+      auto response = "HTTP/1.0 200 OK\r\n"
+        "Content-Type: text/plain; version=0.0.4\r\n"
+        "Content-Length: " + to_string(body.size()) + "\r\n\r\n" + body;
+      for (size_t sent = 0; sent < response.size();) {
+        auto n = send(client, response.data() + sent, response.size() - sent,
+                      MSG_NOSIGNAL);
+        if (n <= 0) break;
+        sent += static_cast<size_t>(n);
+      }
+      close(client);
+    }
+  }
+#endif
+}
+
+bool metrics_start(const string& path)
+{
+#if defined(_WIN32)
+  (void)path;
+  cout << "Metrics are not supported on this platform" << endl;
+  return false;
+#else
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+    cout << "Metrics socket path must be 1 to " << sizeof(addr.sun_path) - 1
+         << " characters" << endl;
+    return false;
+  }
+  copy(path.cbegin(), path.cend(), addr.sun_path);
+
+  // a socket left by an earlier run is replaced; anything else is not ours
+  // to delete
+  struct stat st;
+  if (lstat(path.c_str(), &st) == 0) {
+    if (!S_ISSOCK(st.st_mode)) {
+      cout << "Could not listen on " << path << ": not a socket" << endl;
+      return false;
+    }
+    unlink(path.c_str());
+  }
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0
+      || ::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0
+      || listen(fd, 16) != 0) {
+    cout << "Could not listen on " << path << ": " << strerror(errno) << endl;
+    if (fd >= 0) close(fd);
+    return false;
+  }
+
+  metrics_fd = fd;
+  metrics_path = path;
+  metrics_start_time = chrono::steady_clock::now();
+  collecting_metrics = true;
+  ++form_counters;
+  metrics_thread = thread(serve_metrics, fd);
+  return true;
+#endif
+}
+
+void metrics_stop()
+{
+#if !defined(_WIN32)
+  if (metrics_fd < 0) return;
+  // wakes the accept
+  shutdown(metrics_fd, SHUT_RDWR);
+  metrics_thread.join();
+  close(metrics_fd);
+  unlink(metrics_path.c_str());
+  metrics_fd = -1;
+  collecting_metrics = false;
+  --form_counters;
+#endif
+}
+
+bool profile_start(unsigned hz)
+{
+#if defined(_WIN32)
+  (void)hz;
+  cout << "Profiling is not supported on this platform" << endl;
+  return false;
+#else
+  if (hz == 0 || hz > 1000000) {
+    cout << "Profiling rate must be between 1 and 1000000 Hz" << endl;
+    return false;
+  }
+
+  samples.assign(sample_buffer_size, 0);
+  samples_end = 0;
+  samples_dropped = 0;
+  signal(SIGPROF, on_sigprof);
+
+  itimerval timer{};
+  timer.it_interval.tv_usec = static_cast<suseconds_t>(1000000 / hz);
+  timer.it_value = timer.it_interval;
+  if (setitimer(ITIMER_PROF, &timer, nullptr) != 0) {
+    cout << "Could not start the profiling timer" << endl;
+    signal(SIGPROF, SIG_DFL);
+    return false;
+  }
+  profile_mode |= sampling;
+  return true;
+#endif
+}
+
+void profile_stop(ostream& os)
+{
+  if (!(profile_mode & sampling)) return;
+#if !defined(_WIN32)
+  itimerval timer{};
+  setitimer(ITIMER_PROF, &timer, nullptr);
+  signal(SIGPROF, SIG_IGN);
+#endif
+  profile_mode &= ~sampling;
+
+  // fold identical stacks; every stack is rooted at the interpreter itself
+  map<string, size_t> stacks;
+  auto end = min(samples_end.load(), samples.size());
+  for (size_t pos = 0; pos < end; pos += samples[pos] + 1) {
+    string stack = "blisp";
+    for (size_t i = 0; i < samples[pos]; ++i) {
+      stack += ';';
+      stack += profile_names[samples[pos + 1 + i]];
+    }
+    ++stacks[stack];
+  }
+  for (const auto& st : stacks) {
+    os << st.first << ' ' << st.second << '\n';
+  }
+  if (samples_dropped) {
+    cout << "Profile buffer full: dropped " << samples_dropped
+         << " samples" << endl;
+  }
+  samples = vector<uint32_t>();
+}
+
+void profile_calls(bool on)
+{
+  if (on && !(profile_mode & counting)) {
+    call_stats.clear();
+    call_stack.clear();
+    ++counting_session;
+    ++form_counters;
+    counting_start_ticks = ticks();
+    counting_start_time = chrono::steady_clock::now();
+    profile_mode |= counting;
+  } else if (!on && (profile_mode & counting)) {
+    profile_mode &= ~counting;
+    --form_counters;
+  }
+}
+
+void profile_allocations(unsigned period)
+{
+  if (period) {
+    allocation_sites.clear();
+    allocation_stacks.clear();
+    allocation_period = allocation_countdown = period;
+    allocation_hook = note_allocation;
+    if (!(profile_mode & allocations)) {
+      allocation_next = insert_list_evaluator(allocation_eval_list);
+    }
+    profile_mode |= allocations;
+  } else {
+    allocation_hook = nullptr;
+    if (profile_mode & allocations) {
+      remove_list_evaluator(allocation_eval_list, allocation_next);
+    }
+    profile_mode &= ~allocations;
+  }
+}
+
+void allocation_report(ostream& os)
+{
+  // sites are kept by source id, and reported by line
+  map<tuple<string, uint32_t, string>, AllocationStats> lines;
+  for (const auto& s : allocation_sites) {
+    auto loc = source_location(s.first.source);
+    auto line = s.first.source
+      ? source_files[loc.file] + ":" + to_string(loc.line) : "<no source>";
+    auto& st = lines[make_tuple(line, s.first.function,
+                                type_name(s.first.type))];
+    st.count += s.second.count;
+    st.bytes += s.second.bytes;
+  }
+  using Site = pair<tuple<string, uint32_t, string>, AllocationStats>;
+  vector<Site> sites(lines.cbegin(), lines.cend());
+
+  auto print_top = [&] (const string& title, auto key) {
+    stable_sort(sites.begin(), sites.end(),
+                [&] (const Site& a, const Site& b) { return key(a) > key(b); });
+    os << title << '\n';
+    os << left << setw(24) << "site" << setw(24) << "function"
+       << setw(16) << "type" << right
+       << setw(12) << "count" << setw(14) << "bytes" << '\n';
+    for (size_t i = 0; i < sites.size() && i < 20; ++i) {
+      const auto& st = sites[i];
+      os << left << setw(24) << get<0>(st.first).substr(0, 23)
+         << setw(24) << profile_names[get<1>(st.first)].substr(0, 23)
+         << setw(16) << get<2>(st.first).substr(0, 15) << right
+         << setw(12) << st.second.count
+         << setw(14) << st.second.bytes << '\n';
+    }
+  };
+  print_top("top sites by count",
+            [] (const Site& st) { return st.second.count; });
+  os << '\n';
+  print_top("top sites by bytes",
+            [] (const Site& st) { return st.second.bytes; });
+
+  os << "\nsampled stacks, 1 in " << allocation_period << '\n';
+  for (const auto& st : allocation_stacks) {
+    string stack = "blisp";
+    for (auto id : st.first) {
+      stack += ';';
+      stack += profile_names[id];
+    }
+    os << stack << ' ' << st.second.bytes << '\n';
+  }
+}
+
+void profile_report(ostream& os)
+{
+  auto elapsed = chrono::duration<double, milli>(
+    chrono::steady_clock::now() - counting_start_time).count();
+  auto elapsed_ticks = ticks() - counting_start_ticks;
+  auto ms_per_tick = elapsed_ticks ? elapsed / elapsed_ticks : 0.0;
+
+  vector<uint32_t> ids;
+  for (uint32_t id = 0; id < call_stats.size(); ++id) {
+    if (call_stats[id].calls) ids.push_back(id);
+  }
+  sort(ids.begin(), ids.end(),
+       [] (uint32_t a, uint32_t b) {
+         return call_stats[a].exclusive > call_stats[b].exclusive;
+       });
+
+  os << left << setw(32) << "function" << right
+     << setw(12) << "calls"
+     << setw(14) << "incl ms"
+     << setw(14) << "excl ms"
+     << setw(12) << "allocs" << '\n';
+  os << fixed << setprecision(3);
+  for (auto id : ids) {
+    const auto& st = call_stats[id];
+    os << left << setw(32) << profile_names[id].substr(0, 31) << right
+       << setw(12) << st.calls
+       << setw(14) << st.inclusive * ms_per_tick
+       << setw(14) << st.exclusive * ms_per_tick
+       << setw(12) << st.allocations << '\n';
+  }
+  os.flags(ios::fmtflags{});
+}
+
+//------------------------------------------------------------------------------
+
+FormPtr eval(const FormPtr& form, Environment& e)
+{
+  if (form) return form->eval(e);
+  return FormPtr{};
+}
+
+FormPtr eval_let(const vector<FormPtr>& v, Environment& e)
+{
+  if (v.size() != 3) {
+    cout << "Wrong number of arguments to let, expecting 2, got "
+         << v.size()-1 << endl;
+    return nullptr;
+  }
+
+  List* l = dynamic_cast<List*>(v[1].get());
+  if (!l) {
+    cout << "First argument to let must be a list" << endl;
+    return nullptr;
+  }
+
+  auto binding = l->m_elements;
+  if (binding.size() != 2) {
+    cout << "Too many elements in let binding list" << endl;
+    return nullptr;
+  }
+
+  Environment let_env(&e);
+  let_env.set(binding[0]->print(), binding[1]->eval(e));
+
+  return eval(v[2], let_env);
+}
+
+// branches, when given, counts the evaluations of each branch for coverage
+FormPtr eval_if(const vector<FormPtr>& v, Environment& e,
+                array<uint64_t, 2>* branches = nullptr)
+{
+  if (v.size() != 4) {
+    cout << "Wrong number of arguments to if, expecting 3, got "
+         << v.size()-1 << endl;
+    return nullptr;
+  }
+
+  auto f = eval(v[1], e);
+  if (f->is_truthy())
+  {
+    if (branches) ++(*branches)[0];
+    return eval(v[2], e);
+  }
+  else
+  {
+    if (branches) ++(*branches)[1];
+    return eval(v[3], e);
+  }
+}
+
+FormPtr eval_lambda(const vector<FormPtr>& v, Environment&)
+{
+  if (v.size() != 3) {
+    cout << "Wrong number of arguments to lambda, expecting 2, got "
+         << v.size()-1 << endl;
+    return nullptr;
+  }
+
+  List* l = dynamic_cast<List*>(v[1].get());
+  if (!l) {
+    cout << "First argument to lambda must be a list" << endl;
+    return nullptr;
+  }
+
+  vector<string> params;
+  for (const auto& f : l->m_elements)
+  {
+    params.emplace_back(f->print());
+  }
+  auto f = make_form<Function>(std::move(params), v[2]);
+  f->m_source = v.front()->m_source;
+  return f;
+}
+
+// whether f takes n arguments
+bool takes(const Function& f, size_t n)
+{
+  return n <= f.m_params.size() && n + f.m_optional >= f.m_params.size();
+}
+
+string arity(const Function& f)
+{
+  auto n = to_string(f.m_params.size());
+  if (!f.m_optional) return n;
+  return to_string(f.m_params.size() - f.m_optional) + " to " + n;
+}
+
+FormPtr apply(const Function& f,
+              typename vector<FormPtr>::const_iterator first,
+              typename vector<FormPtr>::const_iterator last,
+              Environment& e)
+{
+  if (!takes(f, static_cast<size_t>(distance(first, last)))) {
+    cout << "Not enough arguments to function, expecting "
+         << arity(f) << ", got " << distance(first, last) << endl;
+    return nullptr;
+  }
+
+  Environment apply_env(&e);
+  auto i = f.m_params.cbegin();
+  for (; first != last; ++i, ++first)
+  {
+    auto arg = (*first)->eval(e);
+    if (!arg) {
+      cout << "Could not evaluate function param: " << (*first)->print()
+           << at(**first) << endl;
+      return nullptr;
+    }
+    apply_env.set(*i, arg);
+  }
+  for (; i != f.m_params.cend(); ++i) apply_env.set(*i, make_form<Nil>());
+
+  ProfileFrame frame(f);
+  return invoke(f, apply_env);
+}
+
+// apply a function to arguments that are already evaluated
+FormPtr call(const Function& f, const vector<FormPtr>& args, Environment& e)
+{
+  if (!takes(f, args.size())) {
+    cout << "Wrong number of arguments to function, expecting "
+         << arity(f) << ", got " << args.size() << endl;
+    return nullptr;
+  }
+
+  Environment call_env(&e);
+  for (size_t i = 0; i < f.m_params.size(); ++i)
+  {
+    call_env.set(f.m_params[i], i < args.size() ? args[i] : make_form<Nil>());
+  }
+  ProfileFrame frame(f);
+  return invoke(f, call_env);
+}
+
+FormPtr eval_set(const vector<FormPtr>& v, Environment& e)
+{
+  if (v.size() != 3) {
+    cout << "Wrong number of arguments to set!, expecting 2, got "
+         << v.size()-1 << endl;
+    return nullptr;
+  }
+
+  Symbol* s = dynamic_cast<Symbol*>(v[1].get());
+  if (!s) {
+    cout << "First argument to set! must be a symbol" << endl;
+    return nullptr;
+  }
+
+  auto r = v[2]->eval(e);
+  auto f = dynamic_cast<Function*>(r.get());
+  if (f && f->m_name.empty()) f->m_name = s->print();
+  e.set(s->print(), r);
+  return r;
+}
+
+FormPtr eval_quote(const vector<FormPtr>& v, Environment&)
+{
+  if (v.size() != 2) {
+    cout << "Wrong number of arguments to quote, expecting 1, got "
+         << v.size()-1 << endl;
+    return nullptr;
+  }
+  return v[1];
+}
+
+FormPtr eval_begin(const vector<FormPtr>& v, Environment& e)
+{
+  FormPtr f;
+  for (auto i = v.cbegin()+1; i != v.cend(); ++i)
+  {
+    f = (*i)->eval(e);
+  }
+  return f;
+}
+
+FormPtr eval_defrecord(const vector<FormPtr>& v, Environment& e)
+{
+  if (v.size() != 3) {
+    cout << "Wrong number of arguments to defrecord, expecting 2, got "
+         << v.size()-1 << endl;
+    return nullptr;
+  }
+
+  Symbol* s = dynamic_cast<Symbol*>(v[1].get());
+  if (!s) {
+    cout << "First argument to defrecord must be a symbol" << endl;
+    return nullptr;
+  }
+
+  auto type = make_shared<RecordType>();
+  type->m_name = s->print();
+  if (!dynamic_cast<Nil*>(v[2].get())) {
+    List* l = dynamic_cast<List*>(v[2].get());
+    if (!l) {
+      cout << "Second argument to defrecord must be a list of fields" << endl;
+      return nullptr;
+    }
+    for (const auto& f : l->m_elements) {
+      if (!dynamic_cast<Symbol*>(f.get())) {
+        cout << "Record field names must be symbols, got " << f->print()
+             << endl;
+        return nullptr;
+      }
+      type->m_fields.push_back(f->print());
+    }
+  }
+
+  e.set(type->m_name, make_form<RecordConstructor>(type));
+  e.set(type->m_name + "?", make_form<BuiltinFunction>(
+            vector<string>{"a"},
+            [type] (Environment& env) -> FormPtr {
+              auto r = dynamic_cast<Record*>(env.lookup("a").get());
+              if (r && r->m_type == type) return make_form<True>();
+              return make_form<False>();
+            }));
+  for (size_t i = 0; i < type->m_fields.size(); ++i) {
+    e.set(type->m_name + "-" + type->m_fields[i],
+          make_form<RecordAccessor>(type, i));
+  }
+  return v[1];
+}
+
+// (defprotocol Name (method (params...)) ...)
+FormPtr eval_defprotocol(const vector<FormPtr>& v, Environment& e)
+{
+  Symbol* s = v.size() > 1 ? dynamic_cast<Symbol*>(v[1].get()) : nullptr;
+  if (!s) {
+    cout << "First argument to defprotocol must be a symbol" << endl;
+    return nullptr;
+  }
+
+  vector<pair<string, vector<string>>> methods;
+  for (auto i = v.cbegin() + 2; i != v.cend(); ++i) {
+    List* l = dynamic_cast<List*>(i->get());
+    List* params = l && l->m_elements.size() == 2
+      ? dynamic_cast<List*>(l->m_elements[1].get()) : nullptr;
+    if (!params || !dynamic_cast<Symbol*>(l->m_elements[0].get())) {
+      cout << "Protocol methods must look like (name (params...)), got "
+           << (*i)->print() << endl;
+      return nullptr;
+    }
+    vector<string> names;
+    for (const auto& p : params->m_elements) names.push_back(p->print());
+    methods.emplace_back(l->m_elements[0]->print(), std::move(names));
+  }
+
+  for (auto& m : methods) {
+    auto name = m.first;
+    e.set(name, make_form<ProtocolMethod>(std::move(m.second),
+                                            std::move(m.first), s->print()));
+  }
+  ++dispatch_version;
+  return v[1];
+}
+
+// (extend-type Type Protocol (method impl) ...)
+FormPtr eval_extend_type(const vector<FormPtr>& v, Environment& e)
+{
+  if (v.size() < 3) {
+    cout << "Wrong number of arguments to extend-type, expecting at least 2, "
+         << "got " << v.size()-1 << endl;
+    return nullptr;
+  }
+
+  auto type = type_key_by_name(v[1]->print(), e);
+  if (!type) {
+    cout << "Unknown type " << v[1]->print() << endl;
+    return nullptr;
+  }
+
+  for (auto i = v.cbegin() + 3; i != v.cend(); ++i) {
+    List* l = dynamic_cast<List*>(i->get());
+    if (!l || l->m_elements.size() != 2) {
+      cout << "Implementations must look like (method function), got "
+           << (*i)->print() << endl;
+      return nullptr;
+    }
+    auto m = dynamic_pointer_cast<ProtocolMethod>(eval(l->m_elements[0], e));
+    if (!m || m->m_protocol != v[2]->print()) {
+      cout << l->m_elements[0]->print() << " is not a method of "
+           << v[2]->print() << endl;
+      return nullptr;
+    }
+    auto impl = dynamic_pointer_cast<Function>(eval(l->m_elements[1], e));
+    if (!impl || impl->m_params.size() != m->m_params.size()) {
+      cout << "Implementation of " << m->m_name << " must be a function of "
+           << m->m_params.size() << " arguments" << endl;
+      return nullptr;
+    }
+    m->m_impls[type] = impl;
+  }
+  ++dispatch_version;
+  return v[1];
+}
+
+// (defmulti name dispatch-fn)
+FormPtr eval_defmulti(const vector<FormPtr>& v, Environment& e)
+{
+  if (v.size() != 3) {
+    cout << "Wrong number of arguments to defmulti, expecting 2, got "
+         << v.size()-1 << endl;
+    return nullptr;
+  }
+
+  Symbol* s = dynamic_cast<Symbol*>(v[1].get());
+  auto f = dynamic_pointer_cast<Function>(eval(v[2], e));
+  if (!s || !f) {
+    cout << "defmulti needs a name and a dispatch function" << endl;
+    return nullptr;
+  }
+  e.set(s->print(), make_form<MultiFn>(s->print(), f));
+  ++dispatch_version;
+  return v[1];
+}
+
+// evaluate a call to a protocol method or multimethod, caching the choice of
+// implementation on the call site's head symbol
+FormPtr eval_dispatch(const Dispatcher& d, const vector<FormPtr>& v,
+                      Environment& e)
+{
+  if (d.m_params.size() != v.size() - 1) {
+    cout << "Wrong number of arguments to " << d.m_name << ", expecting "
+         << d.m_params.size() << ", got " << v.size() - 1 << endl;
+    return nullptr;
+  }
+
+  vector<FormPtr> args;
+  for (auto i = v.cbegin() + 1; i != v.cend(); ++i) {
+    auto arg = eval(*i, e);
+    if (!arg) {
+      cout << "Could not evaluate function param: " << (*i)->print();
+      return nullptr;
+    }
+    args.push_back(arg);
+  }
+
+  DispatchCache* cache = nullptr;
+  if (auto s = dynamic_cast<Symbol*>(v.front().get())) {
+    auto& c = s->m_dispatch_cache;
+    // the symbol may have been rebound to a different method with set!
+    if (!c || c->m_owner != &d) {
+      c = make_shared<DispatchCache>();
+      c->m_owner = &d;
+    }
+    cache = c.get();
+  }
+  return d.dispatch(args, e, cache);
+}
+
+// (with-counters (:cycles :instructions ...) expr) evaluates expr and returns
+// (result counts), where counts maps each counter to its delta, or to nil if
+// the counter is unavailable
+FormPtr eval_with_counters(const vector<FormPtr>& v, Environment& e)
+{
+  if (v.size() != 3) {
+    cout << "Wrong number of arguments to with-counters, expecting 2, got "
+         << v.size()-1 << endl;
+    return nullptr;
+  }
+
+  // () reads as nil
+  List* names = dynamic_cast<List*>(v[1].get());
+  if (!names && !dynamic_cast<Nil*>(v[1].get())) {
+    cout << "First argument to with-counters must be a list of counters"
+         << endl;
+    return nullptr;
+  }
+
+  vector<shared_ptr<Symbol>> keys;
+  vector<unique_ptr<HardwareCounter>> counters;
+  for (const auto& n : names ? names->m_elements : vector<FormPtr>{}) {
+    auto k = dynamic_pointer_cast<Symbol>(n);
+    auto spec = k ? find_counter(k->print()) : nullptr;
+    if (!spec) {
+      cout << "Unknown counter " << n->print() << ", expecting one of";
+      for (const auto& c : counter_specs) cout << ' ' << c.name;
+      cout << endl;
+      return nullptr;
+    }
+    keys.push_back(k);
+    counters.push_back(make_unique<HardwareCounter>(*spec));
+  }
+
+  for (auto& c : counters) c->start();
+  auto result = eval(v[2], e);
+  vector<uint64_t> counts(counters.size());
+  vector<bool> ok(counters.size());
+  for (size_t i = counters.size(); i-- > 0;) {
+    ok[i] = counters[i]->stop(counts[i]);
+  }
+  if (!result) return nullptr;
+
+  FormPtr m = make_form<SmallMap>(Shape::root(), vector<FormPtr>{});
+  for (size_t i = 0; i < keys.size(); ++i) {
+    FormPtr value = make_form<Nil>();
+    if (ok[i]) value = make_form<Number>(static_cast<int64_t>(counts[i]));
+    m = assoc(static_cast<SmallMap&>(*m), keys[i], value);
+  }
+  return make_form<List>(vector<FormPtr>{result, m});
+}
+
+namespace
+{
+  // converts ticks measured over an interval to nanoseconds, by comparing
+  // with the steady clock over the same interval
+  struct TickClock
+  {
+    TickClock()
+      : m_ticks(ticks())
+      , m_time(chrono::steady_clock::now())
+    {}
+
+    double ns_per_tick() const
+    {
+      auto t = ticks() - m_ticks;
+      auto ns = chrono::duration<double, nano>(
+        chrono::steady_clock::now() - m_time).count();
+      return t ? ns / t : 0.0;
+    }
+
+    uint64_t m_ticks;
+    chrono::steady_clock::time_point m_time;
+  };
+}
+
+// (time expr) evaluates expr, prints the time it took and the forms it
+// allocated, and returns its value
+FormPtr eval_time(const vector<FormPtr>& v, Environment& e)
+{
+  if (v.size() != 2) {
+    cout << "Wrong number of arguments to time, expecting 1, got "
+         << v.size()-1 << endl;
+    return nullptr;
+  }
+
+  TickClock clock;
+  FormCounting counting;
+  uint64_t forms = forms_created;
+  auto start = ticks();
+  auto result = eval(v[1], e);
+  auto elapsed = ticks() - start;
+  forms = forms_created - forms;
+
+  cout << "Elapsed time: " << fixed << setprecision(3)
+       << elapsed * clock.ns_per_tick() / 1e6 << " ms, " << forms
+       << " forms allocated" << endl;
+  cout.flags(ios::fmtflags{});
+  return result;
+}
+
+// (bench expr :warmup n :iters m) evaluates expr n times unmeasured, then m
+// times measured; prints and returns the mean, median, p99 and standard
+// deviation in nanoseconds
+FormPtr eval_bench(const vector<FormPtr>& v, Environment& e)
+{
+  if (v.size() < 2 || v.size() % 2 != 0) {
+    cout << "bench expects an expression and :warmup/:iters options" << endl;
+    return nullptr;
+  }
+
+  int64_t warmup = 10;
+  int64_t iters = 100;
+  for (size_t i = 2; i < v.size(); i += 2) {
+    auto value = eval(v[i+1], e);
+    auto n = dynamic_cast<Number*>(value.get());
+    if (!n || n->m_value < 0) {
+      cout << "Option " << v[i]->print() << " must be a non-negative number"
+           << endl;
+      return nullptr;
+    }
+    if (v[i]->symb_eq(":warmup")) {
+      warmup = n->m_value;
+    } else if (v[i]->symb_eq(":iters")) {
+      if (n->m_value == 0) {
+        cout << "Option :iters must be positive" << endl;
+        return nullptr;
+      }
+      iters = n->m_value;
+    } else {
+      cout << "Unknown bench option " << v[i]->print() << endl;
+      return nullptr;
+    }
+  }
+
+  for (int64_t i = 0; i < warmup; ++i) {
+    if (!eval(v[1], e)) return nullptr;
+  }
+
+  TickClock clock;
+  vector<uint64_t> samples;
+  samples.reserve(static_cast<size_t>(iters));
+  for (int64_t i = 0; i < iters; ++i) {
+    auto start = ticks();
+    if (!eval(v[1], e)) return nullptr;
+    samples.push_back(ticks() - start);
+  }
+  auto ns_per_tick = clock.ns_per_tick();
+
+  vector<double> ns;
+  for (auto t : samples) ns.push_back(t * ns_per_tick);
+  sort(ns.begin(), ns.end());
+  auto n = ns.size();
+  auto mean = accumulate(ns.cbegin(), ns.cend(), 0.0) / n;
+  auto median = n % 2 ? ns[n/2] : (ns[n/2 - 1] + ns[n/2]) / 2;
+  auto p99 = ns[(n * 99 + 99) / 100 - 1];
+  auto variance = accumulate(ns.cbegin(), ns.cend(), 0.0,
+                             [&] (double acc, double x) {
+                               return acc + (x - mean) * (x - mean);
+                             }) / n;
+  auto stddev = sqrt(variance);
+
+  cout << iters << " iterations: mean " << fixed << setprecision(3)
+       << mean / 1e3 << " us, median " << median / 1e3 << " us, p99 "
+       << p99 / 1e3 << " us, stddev " << stddev / 1e3 << " us" << endl;
+  cout.flags(ios::fmtflags{});
+
+  vector<pair<string, double>> stats =
+    { { ":mean", mean }, { ":median", median }, { ":p99", p99 },
+      { ":stddev", stddev } };
+  FormPtr m = make_form<SmallMap>(Shape::root(), vector<FormPtr>{});
+  for (const auto& st : stats) {
+    m = assoc(static_cast<SmallMap&>(*m), make_form<Symbol>(st.first),
+              make_form<Number>(static_cast<int64_t>(llround(st.second))));
+  }
+  return m;
+}
+
+//------------------------------------------------------------------------------
+// Debugger. While a debugger is attached, lists evaluate through
+// debug_eval_list, which keeps a stack of frames and stops at breakpoints and
+// steps to take commands. Detached, list_evaluator goes straight to
+// eval_list, so evaluation carries no debugging checks at all; break, unbreak
+// and step are builtins rather than special forms for the same reason.
+// Breakpoints are on calls to a function by name, or on a source line
+// ("file:line"), which stops at the first list evaluated on that line.
+
+namespace
+{
+  struct DebugFrame
+  {
+    const List* form;
+    Environment* env;
+  };
+
+  enum class StepMode
+  {
+    none,
+    into, // stop at the next list
+    over, // stop at the next list no deeper than this one
+    out   // stop at the next list shallower than this one
+  };
+
+  vector<DebugFrame> debug_frames;
+  set<string> breakpoints;
+  set<pair<uint32_t, uint32_t>> line_breakpoints; // file and line
+  StepMode step_mode = StepMode::none;
+  size_t step_depth = 0;
+
+  // a breakpoint on a lambda stops on entry, once its parameters are bound:
+  // at its body, which is the next list one deeper than the call that is
+  // evaluated in an environment other than the caller's
+  struct PendingEntry
+  {
+    size_t depth;
+    const Environment* caller;
+  };
+  vector<PendingEntry> pending_entries;
+
+  FormPtr debug_eval_list(const List& l, Environment& e);
+
+  // the evaluator the debugger runs on top of
+  FormPtr (*debuggee_evaluator)(const List& l, Environment& e) = nullptr;
+
+  void debug_attach()
+  {
+    if (list_evaluator == debug_eval_list) return;
+    debuggee_evaluator = list_evaluator;
+    list_evaluator = debug_eval_list;
+  }
+
+  void debug_detach_if_idle()
+  {
+    if (list_evaluator == debug_eval_list && breakpoints.empty()
+        && line_breakpoints.empty() && step_mode == StepMode::none) {
+      list_evaluator = debuggee_evaluator;
+    }
+  }
+
+  string frame_text(const DebugFrame& f)
+  {
+    auto s = f.form->print();
+    if (s.size() > 72) s = s.substr(0, 69) + "...";
+    return s + at(*f.form);
+  }
+
+  // parses "file:line" into a line breakpoint
+  bool line_breakpoint(const string& s, pair<uint32_t, uint32_t>& bp)
+  {
+    auto colon = s.rfind(':');
+    if (colon == string::npos || colon == 0 || colon + 1 == s.size()
+        || !all_of(s.cbegin() + colon + 1, s.cend(),
+                   [] (char c) { return isdigit(c); })) {
+      return false;
+    }
+    bp = { source_file(s.substr(0, colon)),
+           static_cast<uint32_t>(stoul(s.substr(colon + 1))) };
+    return true;
+  }
+
+  bool at_line_breakpoint(const List& l)
+  {
+    if (!l.m_source) return false;
+    auto loc = source_location(l.m_source);
+    if (!line_breakpoints.count({loc.file, loc.line})) return false;
+
+    // only the first list on the line stops, not those nested in it
+    if (debug_frames.size() < 2) return true;
+    const auto& outer = *debug_frames[debug_frames.size() - 2].form;
+    auto nested = any_of(outer.m_elements.cbegin(), outer.m_elements.cend(),
+                         [&] (const FormPtr& f) { return f.get() == &l; });
+    auto outer_loc = source_location(outer.m_source);
+    return !nested || outer_loc.file != loc.file || outer_loc.line != loc.line;
+  }
+
+  void debug_help()
+  {
+    cout << "c: continue   s: step into   n: step over   o: step out\n"
+         << "bt: backtrace   locals: bindings of this frame   "
+         << "p <expr>: evaluate here\n"
+         << "b <name|file:line>: break on calls to name or at a line   "
+         << "d <name|file:line>: delete breakpoint\n"
+         << "q: detach the debugger and continue" << endl;
+  }
+
+  void debug_prompt(const string& reason)
+  {
+    const auto& frame = debug_frames.back();
+    cout << reason << " at depth " << debug_frames.size() << ": "
+         << frame_text(frame) << endl;
+
+    string line;
+    while (cout << "debug> ", getline(cin, line)) {
+      auto space = line.find(' ');
+      auto cmd = line.substr(0, space);
+      auto arg = space == string::npos ? string() : line.substr(space + 1);
+
+      if (cmd == "c") {
+        return;
+      } else if (cmd == "s") {
+        step_mode = StepMode::into;
+        return;
+      } else if (cmd == "n") {
+        step_mode = StepMode::over;
+        step_depth = debug_frames.size();
+        return;
+      } else if (cmd == "o") {
+        step_mode = StepMode::out;
+        step_depth = debug_frames.size();
+        return;
+      } else if (cmd == "q") {
+        breakpoints.clear();
+        line_breakpoints.clear();
+        pending_entries.clear();
+        return;
+      } else if (cmd == "bt") {
+        for (size_t i = debug_frames.size(); i-- > 0;) {
+          cout << "#" << i + 1 << " " << frame_text(debug_frames[i]) << endl;
+        }
+      } else if (cmd == "locals") {
+        // the top level binds only globals
+        if (!frame.env->parent()) continue;
+        // a let binding whose value failed to evaluate is unset
+        for (const auto& b : frame.env->bindings()) {
+          cout << b.first << " = "
+               << (b.second ? b.second->print() : "<unset>") << endl;
+        }
+      } else if (cmd == "p") {
+        // evaluate without stopping at breakpoints inside the expression
+        list_evaluator = debuggee_evaluator;
+        print(eval(read(arg), *frame.env));
+        list_evaluator = debug_eval_list;
+      } else if (cmd == "b" && !arg.empty()) {
+        pair<uint32_t, uint32_t> bp;
+        if (line_breakpoint(arg, bp)) {
+          line_breakpoints.insert(bp);
+        } else {
+          breakpoints.insert(arg);
+        }
+      } else if (cmd == "d" && !arg.empty()) {
+        pair<uint32_t, uint32_t> bp;
+        if (line_breakpoint(arg, bp)) {
+          line_breakpoints.erase(bp);
+        } else {
+          breakpoints.erase(arg);
+        }
+      } else {
+        debug_help();
+      }
+    }
+    // end of input: nobody is left to take commands
+    breakpoints.clear();
+    line_breakpoints.clear();
+  }
+
+  // a lambda whose body is a list, which a breakpoint can stop inside
+  bool enterable(const FormPtr& f)
+  {
+    auto p = f.get();
+    if (!p || typeid(*p) != typeid(Function)) return false;
+    auto body = static_cast<Function*>(p)->m_body.get();
+    return body && typeid(*body) == typeid(List);
+  }
+
+  FormPtr debug_eval_list(const List& l, Environment& e)
+  {
+    const auto& v = l.m_elements;
+    debug_frames.push_back({&l, &e});
+    auto depth = debug_frames.size();
+    struct Pop
+    {
+      size_t depth;
+      ~Pop()
+      {
+        debug_frames.pop_back();
+        // a call that never reached its body has nothing left to stop at
+        if (!pending_entries.empty() && pending_entries.back().depth == depth) {
+          pending_entries.pop_back();
+        }
+      }
+    } pop{depth};
+
+    const char* reason = nullptr;
+    if (!pending_entries.empty() && pending_entries.back().depth + 1 == depth
+        && pending_entries.back().caller != &e) {
+      pending_entries.pop_back();
+      reason = "breakpoint";
+    } else if (step_mode == StepMode::into
+        || (step_mode == StepMode::over && depth <= step_depth)
+        || (step_mode == StepMode::out && depth < step_depth)) {
+      reason = "step";
+    } else if (!breakpoints.empty() && dynamic_cast<Symbol*>(v.front().get())
+               && breakpoints.count(v.front()->print())) {
+      if (enterable(e.lookup(v.front()->print()))) {
+        pending_entries.push_back({depth, &e});
+      } else {
+        reason = "breakpoint";
+      }
+    } else if (!line_breakpoints.empty() && at_line_breakpoint(l)) {
+      reason = "breakpoint";
+    }
+
+    if (reason) {
+      step_mode = StepMode::none;
+      debug_prompt(reason);
+      debug_detach_if_idle();
+    }
+    return debuggee_evaluator(l, e);
+  }
+}
+
+namespace
+{
+  // a breakpoint is a function name, as a string or a quoted symbol, or a
+  // "file:line" string
+  bool breakpoint_arg(const FormPtr& f, string& name,
+                      pair<uint32_t, uint32_t>& bp)
+  {
+    if (auto s = dynamic_cast<String*>(f.get())) {
+      if (!line_breakpoint(s->value(), bp)) name = s->value();
+      return true;
+    }
+    if (dynamic_cast<Symbol*>(f.get())) {
+      name = f->print();
+      return true;
+    }
+    return false;
+  }
+
+  FormPtr set_breakpoint(const FormPtr& where)
+  {
+    string name;
+    pair<uint32_t, uint32_t> bp;
+    if (!breakpoint_arg(where, name, bp)) {
+      cout << "break expects a function name or \"file:line\"" << endl;
+      return nullptr;
+    }
+    if (name.empty()) {
+      line_breakpoints.insert(bp);
+    } else {
+      breakpoints.insert(name);
+    }
+    debug_attach();
+    return where;
+  }
+
+  FormPtr clear_breakpoint(const FormPtr& where)
+  {
+    string name;
+    pair<uint32_t, uint32_t> bp;
+    if (!breakpoint_arg(where, name, bp)) {
+      cout << "unbreak expects a function name or \"file:line\"" << endl;
+      return nullptr;
+    }
+    if (name.empty()) {
+      line_breakpoints.erase(bp);
+    } else {
+      breakpoints.erase(name);
+    }
+    debug_detach_if_idle();
+    return where;
+  }
+
+  // evaluates f, stopping at its first list
+  FormPtr step_into(const FormPtr& f, Environment& e)
+  {
+    step_mode = StepMode::into;
+    debug_attach();
+    auto result = eval(f, e);
+    step_mode = StepMode::none;
+    debug_detach_if_idle();
+    return result;
+  }
+}
+
+ListEvaluator insert_list_evaluator(ListEvaluator f)
+{
+  auto& slot = list_evaluator == debug_eval_list
+    ? debuggee_evaluator : list_evaluator;
+  auto next = slot;
+  slot = f;
+  return next;
+}
+
+void remove_list_evaluator(ListEvaluator f, ListEvaluator next)
+{
+  if (list_evaluator == f) {
+    list_evaluator = next;
+  } else if (list_evaluator == debug_eval_list && debuggee_evaluator == f) {
+    debuggee_evaluator = next;
+  }
+}
+
+//------------------------------------------------------------------------------
+// Coverage evaluation. Like the debugger, coverage swaps list_evaluator, so
+// that evaluation without it carries no counting at all.
+
+namespace
+{
+  FormPtr coverage_eval_list(const List& l, Environment& e)
+  {
+    if (l.m_coverage_id) {
+      ++coverage_counts[l.m_coverage_id];
+      auto branch = coverage_sites[l.m_coverage_id].branch;
+      if (branch != no_branch) {
+        count(&ThreadMetrics::evaluations);
+        return eval_if(l.m_elements, e, &branch_counts[branch]);
+      }
+    }
+    return eval_list(l.m_elements, e);
+  }
+}
+
+void coverage_start()
+{
+  coverage_on = true;
+  // counts every list itself, so chains to nothing
+  insert_list_evaluator(coverage_eval_list);
+}
+
+void coverage_write(ostream& os)
+{
+  struct Line
+  {
+    uint64_t count = 0;
+    vector<size_t> branches;
+  };
+  map<uint32_t, map<uint32_t, Line>> files;
+  for (size_t id = 1; id < coverage_sites.size(); ++id) {
+    const auto& site = coverage_sites[id];
+    auto where = source_location(site.source);
+    auto& line = files[where.file][where.line];
+    line.count = max(line.count, coverage_counts[id]);
+    if (site.branch != no_branch) line.branches.push_back(site.branch);
+  }
+
+  os << "TN:" << endl;
+  for (const auto& file : files) {
+    os << "SF:" << source_files[file.first] << endl;
+    size_t lines_hit = 0;
+    size_t branches_found = 0;
+    size_t branches_hit = 0;
+    for (const auto& l : file.second) {
+      size_t block = 0;
+      for (auto b : l.second.branches) {
+        const auto& taken = branch_counts[b];
+        auto reached = taken[0] + taken[1] != 0;
+        for (size_t i = 0; i < 2; ++i) {
+          os << "BRDA:" << l.first << ',' << block << ',' << i << ',';
+          if (reached) {
+            os << taken[i];
+          } else {
+            os << '-';
+          }
+          os << endl;
+          ++branches_found;
+          if (taken[i]) ++branches_hit;
+        }
+        ++block;
+      }
+    }
+    if (branches_found) {
+      os << "BRF:" << branches_found << endl
+         << "BRH:" << branches_hit << endl;
+    }
+    for (const auto& l : file.second) {
+      os << "DA:" << l.first << ',' << l.second.count << endl;
+      if (l.second.count) ++lines_hit;
+    }
+    os << "LF:" << file.second.size() << endl
+       << "LH:" << lines_hit << endl
+       << "end_of_record" << endl;
+  }
+}
+
+//------------------------------------------------------------------------------
+
+FormPtr eval_list(const vector<FormPtr>& v, Environment& e)
+{
+  count(&ThreadMetrics::evaluations);
+  auto head = v.front().get();
+  if (typeid(*head) == typeid(Symbol)) {
+    switch (static_cast<Symbol*>(head)->m_special) {
+      case SpecialForm::let: return eval_let(v, e);
+      case SpecialForm::if_: return eval_if(v, e);
+      case SpecialForm::lambda: return eval_lambda(v, e);
+      case SpecialForm::set: return eval_set(v, e);
+      case SpecialForm::quote: return eval_quote(v, e);
+      case SpecialForm::begin: return eval_begin(v, e);
+      case SpecialForm::defrecord: return eval_defrecord(v, e);
+      case SpecialForm::defprotocol: return eval_defprotocol(v, e);
+      case SpecialForm::extend_type: return eval_extend_type(v, e);
+      case SpecialForm::defmulti: return eval_defmulti(v, e);
+      case SpecialForm::with_counters: return eval_with_counters(v, e);
+      case SpecialForm::time: return eval_time(v, e);
+      case SpecialForm::bench: return eval_bench(v, e);
+      case SpecialForm::none:
+      default:
+        break;
+    }
+  }
+
+  auto form = v.front()->eval(e);
+  auto p = form.get();
+  if (p && v.size() == 2 && typeid(*p) == typeid(RecordAccessor)) {
+    // field access skips building an environment for the call
+    auto r = eval(v[1], e);
+    return r ? static_cast<RecordAccessor*>(p)->get(r) : nullptr;
+  }
+  if (p && (typeid(*p) == typeid(ProtocolMethod)
+            || typeid(*p) == typeid(MultiFn))) {
+    return eval_dispatch(static_cast<Dispatcher&>(*p), v, e);
+  }
+  Function *f = dynamic_cast<Function*>(p);
+  if (f) {
+    // builtins and functions passed as arguments take the name they are
+    // first called by; lambdas called directly go by where they were read
+    if (f->m_name.empty() && dynamic_cast<Symbol*>(v.front().get())) {
+      f->m_name = v.front()->print();
+    }
+    return apply(*f, v.cbegin()+1, v.cend(), e);
+  }
+
+  cout << "Don't know how to evaluate " << v.front()->print()
+       << at(*v.front()) << endl;
+  return nullptr;
+}
+
+//------------------------------------------------------------------------------
+
+void print(const FormPtr& form)
+{
+  if (!form) return;
+  cout << form->print() << endl;
+}
+
+//------------------------------------------------------------------------------
+template <typename F>
+FormPtr builtin_numeric(Environment &e, const string& op, F&& f)
+{
+  FormPtr a = e.lookup("a");
+  FormPtr b = e.lookup("b");
+  auto anum = dynamic_cast<Number*>(a.get());
+  auto bnum = dynamic_cast<Number*>(b.get());
+
+  if (!a || !b) {
+    cout << "Don't know how to " << op <<  " " << a->print()
+         << " and " << b->print() << endl;
+    return nullptr;
+  }
+  return make_form<Number>(f(anum->m_value, bnum->m_value));
+}
+
+//------------------------------------------------------------------------------
+template <typename F>
+FormPtr builtin_divide(Environment &e, const string& op, F&& f)
+{
+  FormPtr a = e.lookup("a");
+  FormPtr b = e.lookup("b");
+  auto anum = dynamic_cast<Number*>(a.get());
+  auto bnum = dynamic_cast<Number*>(b.get());
+
+  if (!a || !b) {
+    cout << "Don't know how to " << op <<  " " << a->print()
+         << " and " << b->print() << endl;
+    return nullptr;
+  }
+
+  if (bnum->m_value == 0) {
+    cout << "Division by zero" << endl;
+    return FormPtr{};
+  }
+  return make_form<Number>(f(anum->m_value, bnum->m_value));
+}
+
+//------------------------------------------------------------------------------
+// CSV: the file is cut into chunks at record boundaries, and each chunk is
+// parsed on its own thread, row by row, straight into its own unboxed integer
+// columns. A column with any field that isn't an integer is a string column;
+// the string pool isn't shared between threads, so string columns are filled
+// by a second, serial pass that interns their fields.
+
+namespace
+{
+  constexpr size_t parallel_csv_grain = 1 << 22;
+
+  // the end of the record starting at p, given whether p is inside quotes
+  const char* find_record_end(const char* p, const char* end,
+                              bool in_quotes = false)
+  {
+    for (;;) {
+      auto eol = static_cast<const char*>(memchr(p, '\n', end - p));
+      if (!eol) eol = end;
+      // a newline inside a quoted field does not end the record
+      for (auto q = static_cast<const char*>(memchr(p, '"', eol - p)); q;
+           q = static_cast<const char*>(memchr(q + 1, '"', eol - q - 1))) {
+        in_quotes = !in_quotes;
+      }
+      if (!in_quotes || eol == end) return eol;
+      p = eol + 1;
+    }
+  }
+
+  // calls f(column, p, n, quoted) for each field of the record in
+  // [first, last) and counts them; false if the record is malformed
+  template <typename F>
+  bool split_record(const char* first, const char* last, size_t& fields,
+                    F&& f)
+  {
+    fields = 0;
+    bool fast = !memchr(first, '"', last - first);
+    for (;;) {
+      if (!fast && first != last && *first == '"') {
+        auto start = ++first;
+        for (;;) {
+          auto q = static_cast<const char*>(memchr(first, '"', last - first));
+          if (!q) return false;
+          if (q + 1 != last && q[1] == '"') {
+            first = q + 2;
+            continue;
+          }
+          f(fields++, start, static_cast<size_t>(q - start), true);
+          first = q + 1;
+          break;
+        }
+        if (first == last) return true;
+        if (*first++ != ',') return false;
+      } else {
+        auto sep = static_cast<const char*>(memchr(first, ',', last - first));
+        if (!sep) {
+          f(fields++, first, static_cast<size_t>(last - first), false);
+          return true;
+        }
+        f(fields++, first, static_cast<size_t>(sep - first), false);
+        first = sep + 1;
+      }
+    }
+  }
+
+  // calls f(first, last) for each non-empty record in [p, end)
+  template <typename F>
+  void for_each_record(const char* p, const char* end, F&& f)
+  {
+    while (p < end) {
+      auto eol = find_record_end(p, end);
+      auto last = eol;
+      if (last != p && last[-1] == '\r') --last;
+      if (last != p && !f(p, last)) return;
+      p = eol == end ? end : eol + 1;
+    }
+  }
+
+  bool parse_i64(const char* p, size_t n, int64_t& out)
+  {
+    bool neg = false;
+    if (n > 0 && (*p == '-' || *p == '+')) {
+      neg = *p == '-';
+      ++p;
+      --n;
+    }
+    if (n == 0 || n > 19) return false;
+
+    uint64_t v = 0;
+    for (; n > 0; --n, ++p) {
+      unsigned d = static_cast<unsigned char>(*p) - '0';
+      if (d > 9) return false;
+      v = v * 10 + d;
+    }
+    if (v > static_cast<uint64_t>(INT64_MAX) + (neg ? 1 : 0)) return false;
+    out = neg ? static_cast<int64_t>(0 - v) : static_cast<int64_t>(v);
+    return true;
+  }
+
+  string field_value(const char* p, size_t n, bool quoted)
+  {
+    string s(p, n);
+    if (quoted) {
+      // collapse doubled quotes
+      s.erase(unique(s.begin(), s.end(),
+                     [] (char a, char b) { return a == '"' && b == '"'; }),
+              s.end());
+    }
+    return s;
+  }
+
+  struct CsvChunk
+  {
+    const char* first;
+    const char* last;
+
+    vector<vector<int64_t>> i64;
+    vector<char> is_str;
+    size_t records = 0;
+
+    // the first bad record in the chunk, if any
+    bool failed = false;
+    bool malformed = false;
+    size_t fields = 0;
+  };
+
+  void parse_csv_chunk(CsvChunk& c, size_t columns)
+  {
+    TraceScope scope(csv_chunk_id);
+    c.i64.resize(columns);
+    c.is_str.resize(columns);
+    for_each_record(c.first, c.last, [&] (const char* p, const char* last) {
+        auto ok = split_record(
+          p, last, c.fields,
+          [&] (size_t i, const char* f, size_t n, bool) {
+            if (i >= columns || c.is_str[i]) return;
+            int64_t v;
+            if (parse_i64(f, n, v)) {
+              c.i64[i].push_back(v);
+            } else {
+              c.is_str[i] = true;
+              c.i64[i] = vector<int64_t>{};
+            }
+          });
+        if (!ok || c.fields != columns) {
+          c.failed = true;
+          c.malformed = !ok;
+          return false;
+        }
+        ++c.records;
+        return true;
+      });
+  }
+
+  // cuts [p, end) into about n chunks, each starting at a record
+  vector<CsvChunk> csv_chunks(const char* p, const char* end, size_t n)
+  {
+    vector<const char*> cuts;
+    for (size_t i = 1; i < n; ++i) cuts.push_back(p + (end - p) * i / n);
+
+    // whether each cut is inside quotes follows from the parity of the
+    // quotes before it, which is counted a slice per thread
+    vector<size_t> quotes(n);
+    {
+      vector<thread> workers;
+      for (size_t i = 0; i < n; ++i) {
+        workers.emplace_back([&, i] {
+            auto first = i == 0 ? p : cuts[i - 1];
+            auto last = i + 1 == n ? end : cuts[i];
+            quotes[i] = static_cast<size_t>(std::count(first, last, '"'));
+          });
+      }
+      for (auto& t : workers) t.join();
+    }
+
+    vector<CsvChunk> chunks;
+    auto first = p;
+    size_t quotes_before = 0;
+    for (size_t i = 0; i + 1 < n; ++i) {
+      quotes_before += quotes[i];
+      auto eol = find_record_end(cuts[i], end, quotes_before & 1);
+      auto next = eol == end ? end : eol + 1;
+      if (next <= first) continue;
+      chunks.push_back({first, next, {}, {}, 0, false, false, 0});
+      first = next;
+    }
+    chunks.push_back({first, end, {}, {}, 0, false, false, 0});
+    return chunks;
+  }
+}
+
+FormPtr read_csv(const string& path)
+{
+  ifstream in(path, ios::binary);
+  if (!in) {
+    cout << "Could not open " << path << endl;
+    return nullptr;
+  }
+  // one bulk read; records are parsed in place in this buffer
+  in.peek();
+  in.seekg(0, ios::end);
+  auto size = in.tellg();
+  if (in.bad() || size < 0) {
+    cout << "Could not read " << path << endl;
+    return nullptr;
+  }
+  in.clear();
+  in.seekg(0, ios::beg);
+  string buf(static_cast<size_t>(size), '\0');
+  if (!in.read(&buf[0], size)) {
+    cout << "Could not read " << path << endl;
+    return nullptr;
+  }
+
+  const char* p = buf.data();
+  const char* end = p + buf.size();
+
+  // the first record names the columns
+  vector<string> names;
+  auto body = end;
+  bool header_ok = true;
+  for_each_record(p, end, [&] (const char* first, const char* last) {
+      size_t fields;
+      header_ok = split_record(
+        first, last, fields,
+        [&] (size_t, const char* f, size_t n, bool quoted) {
+          names.push_back(field_value(f, n, quoted));
+        });
+      auto eol = find_record_end(first, end);
+      body = eol == end ? end : eol + 1;
+      return false;
+    });
+  if (!header_ok) {
+    cout << "Malformed CSV record 0 in " << path << endl;
+    return nullptr;
+  }
+  if (names.empty()) {
+    return make_form<Nil>();
+  }
+  auto columns = names.size();
+
+  size_t n = min<size_t>(max(thread::hardware_concurrency(), 1u),
+                         static_cast<size_t>(end - body) / parallel_csv_grain);
+  vector<CsvChunk> chunks;
+  if (n <= 1) {
+    chunks.push_back({body, end, {}, {}, 0, false, false, 0});
+    parse_csv_chunk(chunks.back(), columns);
+  } else {
+    chunks = csv_chunks(body, end, n);
+    vector<thread> workers;
+    for (auto& c : chunks) {
+      workers.emplace_back([&] { parse_csv_chunk(c, columns); });
+    }
+    for (auto& t : workers) t.join();
+  }
+
+  size_t records = 1;
+  for (const auto& c : chunks) {
+    if (c.failed) {
+      if (c.malformed) {
+        cout << "Malformed CSV record " << records + c.records << " in "
+             << path << endl;
+      } else {
+        cout << "Wrong number of fields in CSV record " << records + c.records
+             << ", expecting " << columns << ", got " << c.fields << endl;
+      }
+      return nullptr;
+    }
+    records += c.records;
+  }
+
+  // stitch the chunks' integer columns together
+  vector<shared_ptr<Column>> cols;
+  bool any_str = false;
+  for (size_t i = 0; i < columns; ++i) {
+    auto is_str = any_of(chunks.cbegin(), chunks.cend(),
+                         [i] (const CsvChunk& c) { return c.is_str[i]; });
+    auto c = make_form<Column>(std::move(names[i]),
+                               is_str ? Column::Type::Str
+                                      : Column::Type::I64);
+    if (is_str) {
+      c->m_str.reserve(records - 1);
+      any_str = true;
+    } else {
+      c->m_i64.reserve(records - 1);
+      for (auto& chunk : chunks) {
+        c->m_i64.insert(c->m_i64.end(), chunk.i64[i].cbegin(),
+                        chunk.i64[i].cend());
+        chunk.i64[i] = vector<int64_t>{};
+      }
+    }
+    cols.push_back(std::move(c));
+  }
+
+  if (any_str) {
+    auto& pool = string_pool();
+    for_each_record(body, end, [&] (const char* first, const char* last) {
+        size_t fields;
+        split_record(first, last, fields,
+                     [&] (size_t i, const char* f, size_t n, bool quoted) {
+                       auto& c = *cols[i];
+                       if (c.m_type != Column::Type::Str) return;
+                       if (quoted && memchr(f, '"', n)) {
+                         auto s = field_value(f, n, quoted);
+                         c.m_str.push_back(pool.intern(s.data(), s.size()));
+                       } else {
+                         c.m_str.push_back(pool.intern(f, n));
+                       }
+                     });
+        return true;
+      });
+  }
+
+  return make_form<List>(vector<FormPtr>(cols.cbegin(), cols.cend()));
+}
+
+//------------------------------------------------------------------------------
+// Table kernels: these work on whole columns and selection bitmaps, never on
+// boxed rows
+
+using Bitmap = vector<uint64_t>;
+
+namespace
+{
+  unsigned count_trailing_zeros(uint64_t w)
+  {
+#if defined(__GNUC__)
+    return static_cast<unsigned>(__builtin_ctzll(w));
+#else
+    unsigned n = 0;
+    for (; !(w & 1); w >>= 1) ++n;
+    return n;
+#endif
+  }
+
+  template <typename T, typename Pred>
+  Bitmap select_bits(const vector<T>& v, Pred p)
+  {
+    Bitmap bits((v.size() + 63) / 64);
+    for (size_t i = 0; i < v.size(); ++i) {
+      bits[i / 64] |= static_cast<uint64_t>(p(v[i])) << (i % 64);
+    }
+    return bits;
+  }
+
+  vector<size_t> selected_rows(const Bitmap& bits)
+  {
+    vector<size_t> rows;
+    for (size_t w = 0; w < bits.size(); ++w) {
+      for (auto b = bits[w]; b; b &= b - 1) {
+        rows.push_back(w * 64 + count_trailing_zeros(b));
+      }
+    }
+    return rows;
+  }
+
+  // the value used for hashing and equality: string ids are global, so they
+  // compare directly across columns
+  int64_t key_at(const Column& c, size_t i)
+  {
+    return c.m_type == Column::Type::I64 ? c.m_i64[i] : c.m_str[i];
+  }
+
+  ColumnPtr gather(const Column& c, const vector<size_t>& rows,
+                   string name = string{})
+  {
+    auto r = make_form<Column>(name.empty() ? string(c.m_name) : std::move(name),
+                                 c.m_type);
+    if (c.m_type == Column::Type::I64) {
+      r->m_i64.reserve(rows.size());
+      for (auto i : rows) r->m_i64.push_back(c.m_i64[i]);
+    } else {
+      r->m_str.reserve(rows.size());
+      for (auto i : rows) r->m_str.push_back(c.m_str[i]);
+    }
+    return r;
+  }
+
+  shared_ptr<Table> gather(const Table& t, const vector<size_t>& rows)
+  {
+    vector<ColumnPtr> columns;
+    for (const auto& c : t.m_columns) {
+      columns.push_back(gather(*c, rows));
+    }
+    return make_form<Table>(std::move(columns));
+  }
+
+  template <typename T>
+  bool compare_bits(const vector<T>& v, const string& op, T x, Bitmap& bits)
+  {
+    if (op == "=") bits = select_bits(v, [=] (T y) { return y == x; });
+    else if (op == "!=") bits = select_bits(v, [=] (T y) { return y != x; });
+    else if (op == "<") bits = select_bits(v, [=] (T y) { return y < x; });
+    else if (op == "<=") bits = select_bits(v, [=] (T y) { return y <= x; });
+    else if (op == ">") bits = select_bits(v, [=] (T y) { return y > x; });
+    else if (op == ">=") bits = select_bits(v, [=] (T y) { return y >= x; });
+    else return false;
+    return true;
+  }
+}
+
+FormPtr table_filter(const Table& t, const string& name, const string& op,
+                     const FormPtr& value)
+{
+  auto c = t.find(name);
+  if (!c) {
+    cout << "No such column: " << name << endl;
+    return nullptr;
+  }
+
+  Bitmap bits;
+  bool ok = false;
+  if (c->m_type == Column::Type::I64) {
+    auto n = dynamic_cast<Number*>(value.get());
+    if (!n) {
+      cout << "Can't compare i64 column " << name << " with "
+           << value->print() << endl;
+      return nullptr;
+    }
+    ok = compare_bits(c->m_i64, op, n->m_value, bits);
+  } else {
+    auto str = dynamic_cast<String*>(value.get());
+    if (!str) {
+      cout << "Can't compare string column " << name << " with "
+           << value->print() << endl;
+      return nullptr;
+    }
+    if (op == "=" || op == "!=") {
+      auto id = string_pool().intern(str->data(), str->size());
+      ok = compare_bits(c->m_str, op, id, bits);
+    }
+  }
+  if (!ok) {
+    cout << "Unsupported filter operator " << op << " for column "
+         << name << endl;
+    return nullptr;
+  }
+  return gather(t, selected_rows(bits));
+}
+
+FormPtr table_group_by(const shared_ptr<Table>& t, const string& name)
+{
+  auto c = t->find(name);
+  if (!c) {
+    cout << "No such column: " << name << endl;
+    return nullptr;
+  }
+
+  auto g = make_form<Grouping>();
+  g->m_table = t;
+  g->m_key = c;
+  g->m_group_of_row.reserve(c->size());
+
+  unordered_map<int64_t, uint32_t> groups;
+  for (size_t i = 0; i < c->size(); ++i) {
+    auto r = groups.emplace(key_at(*c, i),
+                            static_cast<uint32_t>(g->m_first_rows.size()));
+    if (r.second) g->m_first_rows.push_back(i);
+    g->m_group_of_row.push_back(r.first->second);
+  }
+  return g;
+}
+
+enum class Aggregate { Count, Sum, Mean };
+
+FormPtr table_aggregate(const Grouping& g, Aggregate agg, const string& name)
+{
+  ColumnPtr c;
+  if (agg != Aggregate::Count) {
+    c = g.m_table->find(name);
+    if (!c || c->m_type != Column::Type::I64) {
+      cout << "No such i64 column: " << name << endl;
+      return nullptr;
+    }
+  }
+
+  auto ngroups = g.m_first_rows.size();
+  vector<int64_t> counts(ngroups);
+  vector<int64_t> sums(ngroups);
+  for (size_t i = 0; i < g.m_group_of_row.size(); ++i) {
+    ++counts[g.m_group_of_row[i]];
+  }
+  if (c) {
+    for (size_t i = 0; i < g.m_group_of_row.size(); ++i) {
+      sums[g.m_group_of_row[i]] += c->m_i64[i];
+    }
+  }
+
+  auto r = make_form<Column>(
+      agg == Aggregate::Count ? "count" : agg == Aggregate::Sum ? "sum" : "mean",
+      Column::Type::I64);
+  if (agg == Aggregate::Count) {
+    r->m_i64 = std::move(counts);
+  } else if (agg == Aggregate::Sum) {
+    r->m_i64 = std::move(sums);
+  } else {
+    r->m_i64.resize(ngroups);
+    for (size_t i = 0; i < ngroups; ++i) r->m_i64[i] = sums[i] / counts[i];
+  }
+  return make_form<Table>(
+      vector<ColumnPtr>{gather(*g.m_key, g.m_first_rows), r});
+}
+
+FormPtr table_sort_by(const Table& t, const string& name)
+{
+  auto c = t.find(name);
+  if (!c) {
+    cout << "No such column: " << name << endl;
+    return nullptr;
+  }
+
+  vector<size_t> rows(c->size());
+  for (size_t i = 0; i < rows.size(); ++i) rows[i] = i;
+  if (c->m_type == Column::Type::I64) {
+    const auto& v = c->m_i64;
+    stable_sort(rows.begin(), rows.end(),
+                [&] (size_t i, size_t j) { return v[i] < v[j]; });
+  } else {
+    const auto& v = c->m_str;
+    const auto& pool = string_pool();
+    stable_sort(rows.begin(), rows.end(),
+                [&] (size_t i, size_t j) {
+                  return v[i] != v[j] && pool.lookup(v[i]) < pool.lookup(v[j]);
+                });
+  }
+  return gather(t, rows);
+}
+
+FormPtr table_join(const Table& l, const Table& r, const string& name)
+{
+  auto lkey = l.find(name);
+  auto rkey = r.find(name);
+  if (!lkey || !rkey || lkey->m_type != rkey->m_type) {
+    cout << "Both tables need a join column " << name
+         << " of the same type" << endl;
+    return nullptr;
+  }
+
+  // build on the right, probe from the left
+  unordered_multimap<int64_t, size_t> index;
+  index.reserve(rkey->size());
+  for (size_t i = 0; i < rkey->size(); ++i) {
+    index.emplace(key_at(*rkey, i), i);
+  }
+
+  vector<size_t> lrows;
+  vector<size_t> rrows;
+  for (size_t i = 0; i < lkey->size(); ++i) {
+    auto range = index.equal_range(key_at(*lkey, i));
+    for (auto j = range.first; j != range.second; ++j) {
+      lrows.push_back(i);
+      rrows.push_back(j->second);
+    }
+  }
+
+  vector<ColumnPtr> columns;
+  for (const auto& c : l.m_columns) {
+    columns.push_back(gather(*c, lrows));
+  }
+  for (const auto& c : r.m_columns) {
+    if (c == rkey) continue;
+    columns.push_back(gather(*c, rrows, l.find(c->m_name) ? "r." + c->m_name
+                                                          : string{}));
+  }
+  return make_form<Table>(std::move(columns));
+}
+
+//------------------------------------------------------------------------------
+// A mutable open-addressing hash table in the style of SwissTable. Each slot
+// has a control byte holding 7 bits of its hash (or the empty marker), and a
+// probe compares a whole group of 16 control bytes at once, so a lookup
+// usually touches one key.
+
+class SwissTable
+{
+public:
+  struct Slot
+  {
+    FormPtr key;
+    FormPtr value;
+  };
+
+  SwissTable() : m_ctrl(group_size, empty), m_slots(group_size) {}
+
+  size_t size() const { return m_size; }
+
+  FormPtr* find(const Form& key)
+  {
+    auto h = mix(key.hash());
+    auto i = find_slot(key, h);
+    return i == npos ? nullptr : &m_slots[i].value;
+  }
+
+  // find or insert
+  FormPtr& operator[](const FormPtr& key)
+  {
+    auto h = mix(key->hash());
+    auto i = find_slot(*key, h);
+    if (i != npos) return m_slots[i].value;
+
+    if ((m_size + 1) * 8 > m_slots.size() * 7) {
+      grow();
+    }
+    i = find_empty(h);
+    m_ctrl[i] = h2(h);
+    m_slots[i].key = key;
+    ++m_size;
+    ++m_generation;
+    return m_slots[i].value;
+  }
+
+  // calls f(key, value) for each entry; false if f inserted a key, which
+  // ends the iteration, since slots may have moved
+  template <typename F>
+  bool for_each(F&& f) const
+  {
+    auto generation = m_generation;
+    for (size_t i = 0; i < m_slots.size(); ++i) {
+      if (m_ctrl[i] == empty) continue;
+      f(m_slots[i].key, m_slots[i].value);
+      if (m_generation != generation) return false;
+    }
+    return true;
+  }
+
+private:
+  static constexpr size_t group_size = 16;
+  static constexpr size_t npos = ~size_t{};
+  static constexpr size_t absent = npos - 1;
+  static constexpr int8_t empty = -128;
+
+  static size_t mix(size_t h)
+  {
+    uint64_t x = h;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return static_cast<size_t>(x);
+  }
+
+  static int8_t h2(size_t h) { return static_cast<int8_t>(h & 0x7f); }
+
+  // bit i is set when control byte i of the group equals b
+  static uint32_t match(const int8_t* ctrl, int8_t b)
+  {
+#if defined(__SSE2__)
+    auto g = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ctrl));
+    return static_cast<uint32_t>(
+        _mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8(b))));
+#else
+    uint32_t m = 0;
+    for (size_t i = 0; i < group_size; ++i) {
+      m |= static_cast<uint32_t>(ctrl[i] == b) << i;
+    }
+    return m;
+#endif
+  }
+
+  // triangular probing over a power of two number of groups visits them all
+  template <typename F>
+  size_t probe(size_t h, F&& f) const
+  {
+    auto mask = m_slots.size() / group_size - 1;
+    auto g = (h >> 7) & mask;
+    for (size_t step = 1; ; ++step) {
+      auto i = f(g * group_size);
+      if (i != npos) return i;
+      g = (g + step) & mask;
+    }
+  }
+
+  size_t find_slot(const Form& key, size_t h) const
+  {
+    auto i = probe(h, [&] (size_t base) -> size_t {
+        auto ctrl = &m_ctrl[base];
+        for (auto m = match(ctrl, h2(h)); m; m &= m - 1) {
+          auto j = base + count_trailing_zeros(m);
+          if (m_slots[j].key->equals(key)) return j;
+        }
+        // an empty slot ends the probe sequence: the key is absent
+        return match(ctrl, empty) ? absent : npos;
+      });
+    return i == absent ? npos : i;
+  }
+
+  size_t find_empty(size_t h) const
+  {
+    return probe(h, [&] (size_t base) -> size_t {
+        auto m = match(&m_ctrl[base], empty);
+        return m ? base + count_trailing_zeros(m) : npos;
+      });
+  }
+
+  void grow()
+  {
+    vector<int8_t> ctrl(m_ctrl.size() * 2, empty);
+    vector<Slot> slots(m_slots.size() * 2);
+    swap(ctrl, m_ctrl);
+    swap(slots, m_slots);
+    for (size_t i = 0; i < slots.size(); ++i) {
+      if (ctrl[i] == empty) continue;
+      auto h = mix(slots[i].key->hash());
+      auto j = find_empty(h);
+      m_ctrl[j] = h2(h);
+      m_slots[j] = std::move(slots[i]);
+    }
+  }
+
+  vector<int8_t> m_ctrl;
+  vector<Slot> m_slots;
+  size_t m_size = 0;
+  // bumped by every insertion, to catch one during for_each
+  size_t m_generation = 0;
+};
+
+constexpr size_t SwissTable::group_size;
+constexpr size_t SwissTable::npos;
+constexpr size_t SwissTable::absent;
+constexpr int8_t SwissTable::empty;
+
+struct HashTable : public Form
+{
+  virtual string print() const
+  {
+    return "<hash-table " + to_string(m_table.size()) + " entries>";
+  }
+
+  SwissTable m_table;
+};
+
+//------------------------------------------------------------------------------
+// A B+tree from integer keys to forms. Keys are stored inline in wide nodes
+// (four cache lines of keys each) and leaves are chained, so a range scan is
+// a walk along contiguous arrays rather than a pointer chase per entry.
+
+class BTree
+{
+public:
+  static constexpr size_t order = 32;
+
+  BTree() : m_root(make_unique<Leaf>()) {}
+
+  size_t size() const { return m_size; }
+
+  const FormPtr* find(int64_t k) const
+  {
+    auto l = find_leaf(k);
+    auto i = lower(*l, k);
+    return i < l->n && l->keys[i] == k ? &l->values[i] : nullptr;
+  }
+
+  void insert(int64_t k, const FormPtr& v)
+  {
+    auto s = insert(m_root.get(), k, v);
+    if (s.right) {
+      auto root = make_unique<Inner>();
+      root->n = 1;
+      root->keys[0] = s.key;
+      root->children[0] = std::move(m_root);
+      root->children[1] = std::move(s.right);
+      m_root = std::move(root);
+    }
+  }
+
+  // build from strictly ascending keys, packing every leaf full
+  void bulk_load(const vector<pair<int64_t, FormPtr>>& kvs)
+  {
+    m_size = kvs.size();
+    vector<unique_ptr<Node>> level;
+    vector<int64_t> mins;
+    Leaf* prev = nullptr;
+    for (size_t i = 0; i < kvs.size(); i += order) {
+      auto l = make_unique<Leaf>();
+      for (size_t j = i; j < kvs.size() && j < i + order; ++j) {
+        l->keys[l->n] = kvs[j].first;
+        l->values[l->n++] = kvs[j].second;
+      }
+      if (prev) prev->next = l.get();
+      prev = l.get();
+      mins.push_back(l->keys[0]);
+      level.push_back(std::move(l));
+    }
+    if (level.empty()) {
+      m_root = make_unique<Leaf>();
+      return;
+    }
+
+    while (level.size() > 1) {
+      vector<unique_ptr<Node>> up;
+      vector<int64_t> up_mins;
+      for (size_t i = 0; i < level.size(); i += order + 1) {
+        auto n = make_unique<Inner>();
+        up_mins.push_back(mins[i]);
+        n->children[0] = std::move(level[i]);
+        for (size_t j = i + 1; j < level.size() && j < i + order + 1; ++j) {
+          n->keys[n->n] = mins[j];
+          n->children[++n->n] = std::move(level[j]);
+        }
+        up.push_back(std::move(n));
+      }
+      level = std::move(up);
+      mins = std::move(up_mins);
+    }
+    m_root = std::move(level.front());
+  }
+
+  // greatest key <= k
+  bool floor(int64_t k, int64_t& key, FormPtr& value) const
+  {
+    // separators are exact minimums, so only the leftmost leaf can hold
+    // nothing <= k
+    auto l = find_leaf(k);
+    auto i = upper(*l, k);
+    if (i == 0) return false;
+    key = l->keys[i - 1];
+    value = l->values[i - 1];
+    return true;
+  }
+
+  // least key >= k
+  bool ceiling(int64_t k, int64_t& key, FormPtr& value) const
+  {
+    bool found = false;
+    for_each_from(k, [&] (int64_t fk, const FormPtr& fv) {
+        key = fk;
+        value = fv;
+        found = true;
+        return false;
+      });
+    return found;
+  }
+
+  // visit entries in key order starting from the least key >= k, until f
+  // returns false
+  template <typename F>
+  void for_each_from(int64_t k, F&& f) const
+  {
+    auto l = find_leaf(k);
+    for (auto i = lower(*l, k); l; l = l->next, i = 0) {
+      for (; i < l->n; ++i) {
+        if (!f(l->keys[i], l->values[i])) return;
+      }
+    }
+  }
+
+  template <typename F>
+  void for_each(F&& f) const
+  {
+    for_each_from(INT64_MIN, std::forward<F>(f));
+  }
+
+private:
+  struct Node
+  {
+    Node(bool is_leaf) : leaf(is_leaf) {}
+    virtual ~Node() {}
+
+    bool leaf;
+    size_t n = 0;
+    array<int64_t, order> keys;
+  };
+
+  struct Leaf : public Node
+  {
+    Leaf() : Node(true) {}
+
+    array<FormPtr, order> values;
+    Leaf* next = nullptr;
+  };
+
+  // keys[i] is the least key under children[i+1]
+  struct Inner : public Node
+  {
+    Inner() : Node(false) {}
+
+    array<unique_ptr<Node>, order + 1> children;
+  };
+
+  struct Split
+  {
+    int64_t key;
+    unique_ptr<Node> right;
+  };
+
+  static size_t lower(const Node& n, int64_t k)
+  {
+    size_t i = 0;
+    while (i < n.n && n.keys[i] < k) ++i;
+    return i;
+  }
+
+  static size_t upper(const Node& n, int64_t k)
+  {
+    size_t i = 0;
+    while (i < n.n && n.keys[i] <= k) ++i;
+    return i;
+  }
+
+  const Leaf* find_leaf(int64_t k) const
+  {
+    const Node* n = m_root.get();
+    while (!n->leaf) {
+      n = static_cast<const Inner*>(n)->children[upper(*n, k)].get();
+    }
+    return static_cast<const Leaf*>(n);
+  }
+
+  Split insert(Node* node, int64_t k, const FormPtr& v)
+  {
+    if (node->leaf) {
+      auto l = static_cast<Leaf*>(node);
+      auto i = lower(*l, k);
+      if (i < l->n && l->keys[i] == k) {
+        l->values[i] = v;
+        return Split{};
+      }
+      ++m_size;
+      if (l->n < order) {
+        insert_at(l->keys, l->n, i, k);
+        insert_at(l->values, l->n, i, v);
+        ++l->n;
+        return Split{};
+      }
+
+      // full: move the upper half to a new right sibling
+      auto r = make_unique<Leaf>();
+      auto half = order / 2;
+      for (size_t j = half; j < order; ++j) {
+        r->keys[j - half] = l->keys[j];
+        r->values[j - half] = std::move(l->values[j]);
+      }
+      r->n = order - half;
+      l->n = half;
+      r->next = l->next;
+      l->next = r.get();
+      auto target = i <= half ? l : r.get();
+      auto ti = i <= half ? i : i - half;
+      insert_at(target->keys, target->n, ti, k);
+      insert_at(target->values, target->n, ti, v);
+      ++target->n;
+      auto sep = r->keys[0];
+      return Split{sep, std::move(r)};
+    }
+
+    auto in = static_cast<Inner*>(node);
+    auto c = upper(*in, k);
+    auto s = insert(in->children[c].get(), k, v);
+    if (!s.right) return Split{};
+
+    if (in->n < order) {
+      insert_at(in->keys, in->n, c, s.key);
+      insert_at(in->children, in->n + 1, c + 1, std::move(s.right));
+      ++in->n;
+      return Split{};
+    }
+
+    // full: lay out all order+1 keys, keep the lower half, promote the
+    // middle key and move the rest to a new right sibling
+    array<int64_t, order + 1> keys;
+    array<unique_ptr<Node>, order + 2> children;
+    for (size_t j = 0; j < order; ++j) keys[j] = in->keys[j];
+    for (size_t j = 0; j <= order; ++j) children[j] = std::move(in->children[j]);
+    insert_at(keys, order, c, s.key);
+    insert_at(children, order + 1, c + 1, std::move(s.right));
+
+    auto r = make_unique<Inner>();
+    auto half = (order + 1) / 2;
+    in->n = half;
+    for (size_t j = 0; j < half; ++j) in->keys[j] = keys[j];
+    for (size_t j = 0; j <= half; ++j) in->children[j] = std::move(children[j]);
+    r->n = order - half;
+    for (size_t j = 0; j < r->n; ++j) r->keys[j] = keys[half + 1 + j];
+    for (size_t j = 0; j <= r->n; ++j) {
+      r->children[j] = std::move(children[half + 1 + j]);
+    }
+    return Split{keys[half], std::move(r)};
+  }
+
+  template <typename A, typename T>
+  static void insert_at(A& a, size_t n, size_t i, T&& t)
+  {
+    for (size_t j = n; j > i; --j) a[j] = std::move(a[j - 1]);
+    a[i] = std::forward<T>(t);
+  }
+
+  unique_ptr<Node> m_root;
+  size_t m_size = 0;
+};
+
+constexpr size_t BTree::order;
+
+struct SortedMap : public Form
+{
+  virtual string print() const
+  {
+    return "<sorted-map " + to_string(m_tree.size()) + " entries>";
+  }
+
+  BTree m_tree;
+};
+
+namespace
+{
+  FormPtr make_pair_list(int64_t k, const FormPtr& v)
+  {
+    return make_form<List>(vector<FormPtr>{make_form<Number>(k), v});
+  }
+
+  FormPtr make_list(vector<FormPtr>&& v)
+  {
+    if (v.empty()) return make_form<Nil>();
+    return make_form<List>(std::move(v));
+  }
+}
+
+//------------------------------------------------------------------------------
+// A byte buffer: a view onto a shared, refcounted allocation. Slicing makes a
+// new view of the same allocation without copying.
+
+struct Bytes : public Form
+{
+  // make-bytes allocates and zeroes eagerly, so a mistyped size would
+  // otherwise take the whole machine down (or throw out of the builtin)
+  static constexpr int64_t max_size = int64_t{1} << 32;
+
+  Bytes(size_t n)
+    : m_buffer(make_shared<vector<uint8_t>>(n))
+    , m_offset(0)
+    , m_size(n)
+  {}
+
+  Bytes(const shared_ptr<vector<uint8_t>>& buffer, size_t offset, size_t size)
+    : m_buffer(buffer)
+    , m_offset(offset)
+    , m_size(size)
+  {}
+
+  virtual string print() const
+  {
+    return "<bytes " + to_string(m_size) + ">";
+  }
+
+  // bytes are mutable, so the hash is never cached
+  virtual size_t hash() const
+  {
+    return hash_chars(reinterpret_cast<const char*>(data()), m_size);
+  }
+
+  virtual bool equals(const Form& f) const
+  {
+    auto b = dynamic_cast<const Bytes*>(&f);
+    return b && b->m_size == m_size
+      && (b == this || memcmp(data(), b->data(), m_size) == 0);
+  }
+
+  uint8_t* data() { return m_buffer->data() + m_offset; }
+  const uint8_t* data() const { return m_buffer->data() + m_offset; }
+
+  shared_ptr<vector<uint8_t>> m_buffer;
+  size_t m_offset;
+  size_t m_size;
+};
+
+constexpr int64_t Bytes::max_size;
+
+namespace
+{
+  bool valid_width(int64_t w)
+  {
+    return w == 1 || w == 2 || w == 4 || w == 8;
+  }
+
+  // whether width bytes at off fit in size, checked without overflow
+  bool in_bounds(int64_t off, int64_t width, size_t size)
+  {
+    return off >= 0 && width >= 0 && static_cast<uint64_t>(off) <= size
+      && static_cast<uint64_t>(width) <= size - static_cast<uint64_t>(off);
+  }
+
+  // "be" or "le"; anything else is an error
+  bool parse_endian(const String& s, bool& big_endian)
+  {
+    auto v = s.value();
+    if (v != "be" && v != "le") {
+      cout << "Byte order must be \"le\" or \"be\", got " << s.print()
+           << endl;
+      return false;
+    }
+    big_endian = v == "be";
+    return true;
+  }
+
+  uint64_t read_uint(const uint8_t* p, size_t width, bool big_endian)
+  {
+    uint64_t v = 0;
+    for (size_t i = 0; i < width; ++i) {
+      auto b = big_endian ? p[i] : p[width - 1 - i];
+      v = (v << 8) | b;
+    }
+    return v;
+  }
+
+  void write_uint(uint8_t* p, size_t width, bool big_endian, uint64_t v)
+  {
+    for (size_t i = 0; i < width; ++i) {
+      p[big_endian ? width - 1 - i : i] = static_cast<uint8_t>(v);
+      v >>= 8;
+    }
+  }
+
+  const uint8_t* find_bytes(const uint8_t* hay, size_t n,
+                            const uint8_t* needle, size_t m)
+  {
+#if defined(_WIN32)
+    auto last = hay + n;
+    auto i = search(hay, last, needle, needle + m);
+    return i == last && m > 0 ? nullptr : i;
+#else
+    return static_cast<const uint8_t*>(memmem(hay, n, needle, m));
+#endif
+  }
+}
+
+//------------------------------------------------------------------------------
+// Substrings and sublists are O(1) views. Slices this small are copied
+// instead: the copy costs about as much as the view, and can't keep a large
+// parent alive. compact copies any view out of its parent explicitly.
+
+namespace
+{
+  constexpr size_t small_slice_chars = 64;
+  constexpr size_t small_slice_elements = 8;
+
+  bool slice_bounds(const Form& f, size_t size, const Number& start,
+                    const Number& end)
+  {
+    if (start.m_value < 0 || end.m_value < start.m_value
+        || static_cast<size_t>(end.m_value) > size) {
+      cout << "Slice [" << start.m_value << ", " << end.m_value
+           << ") out of range for " << f.print() << endl;
+      return false;
+    }
+    return true;
+  }
+}
+
+FormPtr substring(const String& s, size_t offset, size_t size)
+{
+  if (size <= small_slice_chars) {
+    return make_form<String>(String::Raw{},
+                               string(s.data() + offset, size));
+  }
+  return make_form<String>(s.m_storage, s.m_offset + offset, size);
+}
+
+FormPtr sublist(const shared_ptr<List>& l, size_t offset, size_t size)
+{
+  if (size == 0) {
+    return make_form<Nil>();
+  }
+  if (size <= small_slice_elements) {
+    auto first = l->m_elements.cbegin() + offset;
+    return make_form<List>(vector<FormPtr>(first, first + size));
+  }
+  return make_form<ListSlice>(l, offset, size);
+}
+
+FormPtr compact(const FormPtr& f)
+{
+  if (auto s = dynamic_cast<String*>(f.get())) {
+    if (s->m_size == s->m_storage->size()) return f;
+    return make_form<String>(String::Raw{}, s->value());
+  }
+  if (auto l = dynamic_cast<ListSlice*>(f.get())) {
+    return make_form<List>(vector<FormPtr>(l->begin(), l->end()));
+  }
+  return f;
+}
+
+//------------------------------------------------------------------------------
+// Regular expressions, matched by lazily built DFAs so that matching never
+// backtracks. A pattern is parsed to a tree, then compiled to two Thompson
+// NFAs: one for the pattern and one for its reverse. Searching is
+// leftmost-longest: one backwards scan with the reverse DFA finds every
+// position where a match can start, then a forwards scan from the leftmost
+// of them finds the longest match.
+//
+// Supported syntax: literals, ., [...] and [^...] classes with ranges,
+// \d \w \s \D \W \S and escaped metacharacters, grouping with (), |, *, +, ?,
+// and ^ and $ anchoring the whole pattern.
+
+using CharSet = bitset<256>;
+
+struct ReNode
+{
+  enum class Kind { Set, Concat, Alt, Star, Plus, Quest };
+
+  ReNode(Kind k) : kind(k) {}
+
+  Kind kind;
+  CharSet set;
+  vector<unique_ptr<ReNode>> kids;
+};
+
+class ReParser
+{
+public:
+  ReParser(const char* first, const char* last) : m_p(first), m_last(last) {}
+
+  unique_ptr<ReNode> parse()
+  {
+    auto n = parse_alt();
+    if (n && m_p != m_last) return error("unbalanced )");
+    return n;
+  }
+
+  string m_error;
+
+private:
+  unique_ptr<ReNode> error(const string& s)
+  {
+    if (m_error.empty()) m_error = s;
+    return nullptr;
+  }
+
+  unique_ptr<ReNode> parse_alt()
+  {
+    auto l = parse_concat();
+    while (l && m_p != m_last && *m_p == '|') {
+      ++m_p;
+      auto r = parse_concat();
+      if (!r) return nullptr;
+      auto n = make_unique<ReNode>(ReNode::Kind::Alt);
+      n->kids.push_back(std::move(l));
+      n->kids.push_back(std::move(r));
+      l = std::move(n);
+    }
+    return l;
+  }
+
+  unique_ptr<ReNode> parse_concat()
+  {
+    auto n = make_unique<ReNode>(ReNode::Kind::Concat);
+    while (m_p != m_last && *m_p != '|' && *m_p != ')') {
+      auto a = parse_repeat();
+      if (!a) return nullptr;
+      n->kids.push_back(std::move(a));
+    }
+    return n;
+  }
+
+  unique_ptr<ReNode> parse_repeat()
+  {
+    auto a = parse_atom();
+    while (a && m_p != m_last
+           && (*m_p == '*' || *m_p == '+' || *m_p == '?')) {
+      auto k = *m_p == '*' ? ReNode::Kind::Star
+        : *m_p == '+' ? ReNode::Kind::Plus : ReNode::Kind::Quest;
+      ++m_p;
+      auto n = make_unique<ReNode>(k);
+      n->kids.push_back(std::move(a));
+      a = std::move(n);
+    }
+    return a;
+  }
+
+  unique_ptr<ReNode> parse_atom()
+  {
+    auto c = *m_p++;
+    if (c == '(') {
+      auto n = parse_alt();
+      if (!n) return nullptr;
+      if (m_p == m_last || *m_p != ')') return error("missing )");
+      ++m_p;
+      return n;
+    }
+    if (c == '*' || c == '+' || c == '?') return error("nothing to repeat");
+
+    auto n = make_unique<ReNode>(ReNode::Kind::Set);
+    if (c == '.') {
+      n->set.set();
+      n->set.reset('\n');
+    } else if (c == '[') {
+      if (!parse_class(n->set)) return nullptr;
+    } else if (c == '\\') {
+      if (m_p == m_last) return error("trailing \\");
+      escape_set(*m_p++, n->set);
+    } else {
+      n->set.set(static_cast<unsigned char>(c));
+    }
+    return n;
+  }
+
+  bool parse_class(CharSet& set)
+  {
+    bool negate = m_p != m_last && *m_p == '^';
+    if (negate) ++m_p;
+    bool first = true;
+    while (m_p != m_last && (first || *m_p != ']')) {
+      first = false;
+      auto c = static_cast<unsigned char>(*m_p++);
+      if (c == '\\' && m_p != m_last) {
+        escape_set(*m_p++, set);
+        continue;
+      }
+      if (m_p + 1 < m_last && *m_p == '-' && m_p[1] != ']') {
+        auto hi = static_cast<unsigned char>(m_p[1]);
+        m_p += 2;
+        for (unsigned i = c; i <= hi; ++i) set.set(i);
+        continue;
+      }
+      set.set(c);
+    }
+    if (m_p == m_last) {
+      error("missing ]");
+      return false;
+    }
+    ++m_p;
+    if (negate) set.flip();
+    return true;
+  }
+
+  static void escape_set(char c, CharSet& set)
+  {
+    CharSet s;
+    switch (c) {
+      case 'd': case 'D':
+        for (unsigned i = '0'; i <= '9'; ++i) s.set(i);
+        break;
+      case 'w': case 'W':
+        for (unsigned i = 0; i < 256; ++i) {
+          if (isalnum(static_cast<int>(i)) || i == '_') s.set(i);
+        }
+        break;
+      case 's': case 'S':
+        for (auto w : { ' ', '\t', '\n', '\r', '\f', '\v' }) {
+          s.set(static_cast<unsigned char>(w));
+        }
+        break;
+      case 'n': s.set('\n'); break;
+      case 't': s.set('\t'); break;
+      default: s.set(static_cast<unsigned char>(c)); break;
+    }
+    if (c == 'D' || c == 'W' || c == 'S') s.flip();
+    set |= s;
+  }
+
+  const char* m_p;
+  const char* m_last;
+};
+
+// the same language, read backwards
+unique_ptr<ReNode> reverse_re(const ReNode& n)
+{
+  auto r = make_unique<ReNode>(n.kind);
+  r->set = n.set;
+  for (const auto& k : n.kids) r->kids.push_back(reverse_re(*k));
+  if (n.kind == ReNode::Kind::Concat) reverse(r->kids.begin(), r->kids.end());
+  return r;
+}
+
+// A Thompson NFA: a state either consumes a character in its set and moves to
+// out, or moves without consuming to out and/or out1
+struct Nfa
+{
+  struct State
+  {
+    bool consumes = false;
+    CharSet set;
+    int out = -1;
+    int out1 = -1;
+  };
+
+  Nfa(const ReNode& n)
+  {
+    m_match = add();
+    m_start = build(n, m_match);
+  }
+
+  int add()
+  {
+    m_states.emplace_back();
+    return static_cast<int>(m_states.size() - 1);
+  }
+
+  // compile n so that it continues to state next
+  int build(const ReNode& n, int next)
+  {
+    switch (n.kind) {
+      case ReNode::Kind::Set: {
+        auto s = add();
+        m_states[s].consumes = true;
+        m_states[s].set = n.set;
+        m_states[s].out = next;
+        return s;
+      }
+      case ReNode::Kind::Concat:
+        for (auto i = n.kids.crbegin(); i != n.kids.crend(); ++i) {
+          next = build(**i, next);
+        }
+        return next;
+      case ReNode::Kind::Alt: {
+        auto l = build(*n.kids[0], next);
+        auto r = build(*n.kids[1], next);
+        auto s = add();
+        m_states[s].out = l;
+        m_states[s].out1 = r;
+        return s;
+      }
+      case ReNode::Kind::Star:
+      case ReNode::Kind::Plus: {
+        auto loop = add();
+        auto body = build(*n.kids[0], loop);
+        m_states[loop].out = body;
+        m_states[loop].out1 = next;
+        return n.kind == ReNode::Kind::Star ? loop : body;
+      }
+      case ReNode::Kind::Quest: {
+        auto body = build(*n.kids[0], next);
+        auto s = add();
+        m_states[s].out = body;
+        m_states[s].out1 = next;
+        return s;
+      }
+      default:
+        return next;
+    }
+  }
+
+  // add the states reachable from s without consuming
+  void closure(int s, vector<int>& set, vector<bool>& seen) const
+  {
+    if (s < 0 || seen[s]) return;
+    seen[s] = true;
+    const auto& st = m_states[s];
+    if (st.consumes || s == m_match) {
+      set.push_back(s);
+      return;
+    }
+    closure(st.out, set, seen);
+    closure(st.out1, set, seen);
+  }
+
+  vector<State> m_states;
+  int m_start;
+  int m_match;
+};
+
+// A DFA built lazily from an NFA: each DFA state is a set of NFA states, and
+// transitions are computed on first use and cached. State 0 is the dead state.
+// An unanchored DFA may start a new match at every position.
+class Dfa
+{
+public:
+  static constexpr int dead = 0;
+  static constexpr size_t max_states = 4096;
+
+  Dfa(const Nfa& nfa, bool unanchored)
+    : m_nfa(nfa)
+    , m_unanchored(unanchored)
+  {
+    reset();
+  }
+
+  int start() const { return m_start; }
+  bool accepting(int s) const { return m_accepting[s]; }
+
+  // bumped when the states are thrown away and renumbered
+  size_t generation() const { return m_generation; }
+
+  int next(int s, unsigned char c)
+  {
+    auto t = m_next[s][c];
+    if (t >= 0) return t;
+
+    vector<int> set;
+    vector<bool> seen(m_nfa.m_states.size());
+    for (auto i : m_sets[s]) {
+      const auto& st = m_nfa.m_states[i];
+      if (st.consumes && st.set.test(c)) m_nfa.closure(st.out, set, seen);
+    }
+    if (m_unanchored) m_nfa.closure(m_nfa.m_start, set, seen);
+    sort(set.begin(), set.end());
+
+    if (m_sets.size() >= max_states) {
+      // bound the memory a pathological pattern can use
+      auto from = m_sets[s];
+      reset();
+      s = intern(std::move(from));
+    }
+    t = intern(std::move(set));
+    m_next[s][c] = t;
+    return t;
+  }
+
+private:
+  void reset()
+  {
+    ++m_generation;
+    m_sets.clear();
+    m_index.clear();
+    m_next.clear();
+    m_accepting.clear();
+    intern(vector<int>{});
+
+    vector<int> set;
+    vector<bool> seen(m_nfa.m_states.size());
+    m_nfa.closure(m_nfa.m_start, set, seen);
+    sort(set.begin(), set.end());
+    m_start = intern(std::move(set));
+  }
+
+  int intern(vector<int>&& set)
+  {
+    auto i = m_index.find(set);
+    if (i != m_index.end()) return i->second;
+
+    auto s = static_cast<int>(m_sets.size());
+    m_accepting.push_back(
+        binary_search(set.cbegin(), set.cend(), m_nfa.m_match));
+    array<int, 256> next;
+    next.fill(-1);
+    m_next.push_back(next);
+    m_index.emplace(set, s);
+    m_sets.push_back(std::move(set));
+    return s;
+  }
+
+  const Nfa& m_nfa;
+  bool m_unanchored;
+  int m_start = dead;
+  size_t m_generation = 0;
+  vector<vector<int>> m_sets;
+  map<vector<int>, int> m_index;
+  vector<array<int, 256>> m_next;
+  vector<bool> m_accepting;
+};
+
+constexpr int Dfa::dead;
+constexpr size_t Dfa::max_states;
+
+class Regex
+{
+public:
+  // returns nullptr (and says why) for a malformed pattern
+  static shared_ptr<Regex> compile(const string& pattern)
+  {
+    auto first = pattern.data();
+    auto last = first + pattern.size();
+    bool anchor_start = first != last && *first == '^';
+    if (anchor_start) ++first;
+    // $ anchors unless escaped, by an odd run of backslashes before it
+    bool anchor_end = first != last && last[-1] == '$';
+    if (anchor_end) {
+      auto escape = last - 1;
+      while (escape != first && escape[-1] == '\\') --escape;
+      anchor_end = (last - 1 - escape) % 2 == 0;
+    }
+    if (anchor_end) --last;
+
+    ReParser p(first, last);
+    auto tree = p.parse();
+    if (!tree) {
+      cout << "Invalid regex " << pattern << ": " << p.m_error << endl;
+      return nullptr;
+    }
+    return shared_ptr<Regex>(new Regex(*tree, anchor_start, anchor_end));
+  }
+
+  bool matches(const char* p, size_t n)
+  {
+    auto s = m_forward_dfa.start();
+    for (size_t i = 0; i < n && s != Dfa::dead; ++i) {
+      s = m_forward_dfa.next(s, static_cast<unsigned char>(p[i]));
+    }
+    return m_forward_dfa.accepting(s);
+  }
+
+  // call f(start, end) for each leftmost-longest, non-overlapping match,
+  // until f returns false
+  template <typename F>
+  void for_each_match(const char* p, size_t n, F&& f)
+  {
+    // where can a match start?
+    vector<bool> can_start(n + 1);
+    if (m_anchor_start) {
+      can_start[0] = true;
+    } else {
+      auto s = m_reverse_dfa.start();
+      can_start[n] = m_reverse_dfa.accepting(s);
+      for (auto i = n; i > 0 && s != Dfa::dead; --i) {
+        s = m_reverse_dfa.next(s, static_cast<unsigned char>(p[i - 1]));
+        can_start[i - 1] = m_reverse_dfa.accepting(s);
+      }
+    }
+
+    ScanMemo memo;
+    memo.generation = m_forward_dfa.generation();
+    for (size_t pos = 0; pos <= n; ) {
+      auto i = find(can_start.cbegin() + pos, can_start.cend(), true);
+      if (i == can_start.cend()) return;
+      auto start = static_cast<size_t>(i - can_start.cbegin());
+      size_t end;
+      if (!longest(p, n, start, end, memo) || !f(start, end)) return;
+      pos = end > start ? end : end + 1;
+    }
+  }
+
+private:
+  Regex(const ReNode& tree, bool anchor_start, bool anchor_end)
+    : m_anchor_start(anchor_start)
+    , m_anchor_end(anchor_end)
+    , m_forward(tree)
+    , m_reverse(*reverse_re(tree))
+    , m_forward_dfa(m_forward, false)
+    , m_reverse_dfa(m_reverse, !anchor_end)
+  {}
+
+  static constexpr size_t none = ~size_t{};
+
+  // The scan for the longest match from a start reads on past the match's
+  // end until the DFA dies, and later scans read that text again. So the
+  // furthest accepting position reachable from each (state, position) read
+  // past a match is remembered, and a later scan reaching the same pair
+  // stops there. Each pair is scanned at most once, so finding all matches
+  // stays linear in the text.
+  struct ScanMemo
+  {
+    unordered_map<uint64_t, size_t> furthest;
+    size_t limit = 0; // no scan has read as far as this
+    size_t generation;
+    vector<int> path;
+    vector<char> accepts;
+    vector<size_t> best;
+  };
+
+  static uint64_t memo_key(int s, size_t i)
+  {
+    return static_cast<uint64_t>(i) * Dfa::max_states
+      + static_cast<uint64_t>(s);
+  }
+
+  bool longest(const char* p, size_t n, size_t start, size_t& end,
+               ScanMemo& memo)
+  {
+    // states are renumbered when the DFA is reset, so pairs from before
+    // then mean nothing
+    if (memo.generation != m_forward_dfa.generation()) {
+      memo.furthest.clear();
+      memo.limit = 0;
+      memo.generation = m_forward_dfa.generation();
+    }
+
+    // path[k] is the state at position start + k, and accepts[k] whether
+    // it accepts; the DFA may be reset part-way through, after which the
+    // ids on the path and in the memo no longer name the same states
+    auto& path = memo.path;
+    auto& accepts = memo.accepts;
+    path.clear();
+    accepts.clear();
+    auto furthest = none;
+    auto s = m_forward_dfa.start();
+    for (auto i = start; ; ++i) {
+      if (i > start && i < memo.limit
+          && memo.generation == m_forward_dfa.generation()) {
+        auto known = memo.furthest.find(memo_key(s, i));
+        if (known != memo.furthest.end()) {
+          furthest = known->second;
+          break;
+        }
+      }
+      path.push_back(s);
+      accepts.push_back(m_forward_dfa.accepting(s));
+      if (i == n) break;
+      s = m_forward_dfa.next(s, static_cast<unsigned char>(p[i]));
+      if (s == Dfa::dead) break;
+    }
+
+    auto& best = memo.best;
+    best.resize(path.size());
+    for (auto k = path.size(); k-- > 0;) {
+      auto i = start + k;
+      if (furthest == none && accepts[k] && (!m_anchor_end || i == n)) {
+        furthest = i;
+      }
+      best[k] = furthest;
+    }
+    end = best[0];
+
+    // later scans start at or after this match's end
+    if (memo.generation == m_forward_dfa.generation()) {
+      auto from = end == none ? 1 : end - start + 1;
+      for (auto k = from; k < path.size(); ++k) {
+        memo.furthest.emplace(memo_key(path[k], start + k), best[k]);
+      }
+      memo.limit = max(memo.limit, start + path.size());
+    }
+    return end != none;
+  }
+
+  bool m_anchor_start;
+  bool m_anchor_end;
+  Nfa m_forward;
+  Nfa m_reverse;
+  Dfa m_forward_dfa;
+  Dfa m_reverse_dfa;
+};
+
+constexpr size_t Regex::none;
+
+// compiled patterns, most recently used first
+class RegexCache
+{
+public:
+  shared_ptr<Regex> get(const string& pattern)
+  {
+    auto i = m_index.find(pattern);
+    if (i != m_index.end()) {
+      m_entries.splice(m_entries.begin(), m_entries, i->second);
+      return i->second->second;
+    }
+
+    TraceScope scope(regex_compile_id);
+    auto re = Regex::compile(pattern);
+    if (!re) return nullptr;
+    if (m_entries.size() == capacity) {
+      m_index.erase(m_entries.back().first);
+      m_entries.pop_back();
+    }
+    m_entries.emplace_front(pattern, re);
+    m_index.emplace(pattern, m_entries.begin());
+    return re;
+  }
+
+private:
+  static constexpr size_t capacity = 64;
+
+  using Entries = list<pair<string, shared_ptr<Regex>>>;
+  Entries m_entries;
+  unordered_map<string, Entries::iterator> m_index;
+};
+
+constexpr size_t RegexCache::capacity;
+
+RegexCache& regex_cache()
+{
+  static RegexCache cache;
+  return cache;
+}
+
+//------------------------------------------------------------------------------
+// Sorting. Integer columns are radix sorted, in parallel chunks that are
+// then merged when the input is large. Lists of numbers or of strings are
+// radix sorted too, without calling back into the evaluator; anything else
+// needs a comparator function, and is merge sorted with it.
+
+namespace
+{
+  constexpr size_t parallel_sort_grain = 1 << 20;
+
+  // LSD radix sort on bytes, skipping passes where every key has the same
+  // byte
+  void radix_sort(uint64_t* p, size_t n, uint64_t* tmp)
+  {
+    auto src = p;
+    auto dst = tmp;
+    for (unsigned shift = 0; shift < 64; shift += 8) {
+      array<size_t, 257> offsets{};
+      for (size_t i = 0; i < n; ++i) ++offsets[((src[i] >> shift) & 0xff) + 1];
+      if (any_of(offsets.cbegin() + 1, offsets.cend(),
+                 [=] (size_t c) { return c == n; })) {
+        continue;
+      }
+      partial_sum(offsets.cbegin(), offsets.cend(), offsets.begin());
+      for (size_t i = 0; i < n; ++i) {
+        dst[offsets[(src[i] >> shift) & 0xff]++] = src[i];
+      }
+      swap(src, dst);
+    }
+    if (src != p) copy(src, src + n, p);
+  }
+
+  // sort chunks on separate threads, then merge pairs of runs in rounds
+  void parallel_radix_sort(vector<uint64_t>& keys)
+  {
+    auto n = keys.size();
+    vector<uint64_t> tmp(n);
+    size_t chunks = min<size_t>(max(thread::hardware_concurrency(), 1u),
+                                n / parallel_sort_grain);
+    if (chunks <= 1) {
+      radix_sort(keys.data(), n, tmp.data());
+      return;
+    }
+
+    vector<size_t> bounds;
+    for (size_t i = 0; i <= chunks; ++i) bounds.push_back(n * i / chunks);
+    {
+      vector<thread> workers;
+      for (size_t i = 0; i < chunks; ++i) {
+        workers.emplace_back([&, i] {
+            TraceScope scope(sort_chunk_id);
+            radix_sort(&keys[bounds[i]], bounds[i+1] - bounds[i],
+                       &tmp[bounds[i]]);
+          });
+      }
+      for (auto& t : workers) t.join();
+    }
+
+    auto src = &keys;
+    auto dst = &tmp;
+    while (bounds.size() > 2) {
+      vector<size_t> merged;
+      vector<thread> workers;
+      for (size_t i = 0; i + 1 < bounds.size(); i += 2) {
+        merged.push_back(bounds[i]);
+        auto first = bounds[i];
+        auto mid = bounds[i + 1];
+        auto last = i + 2 < bounds.size() ? bounds[i + 2] : mid;
+        workers.emplace_back([=] {
+            TraceScope scope(sort_merge_id);
+            merge(src->cbegin() + first, src->cbegin() + mid,
+                  src->cbegin() + mid, src->cbegin() + last,
+                  dst->begin() + first);
+          });
+      }
+      merged.push_back(n);
+      for (auto& t : workers) t.join();
+      bounds = std::move(merged);
+      swap(src, dst);
+    }
+    if (src != &keys) keys.swap(tmp);
+  }
+
+  // order-preserving map from signed to unsigned
+  uint64_t radix_key(int64_t v)
+  {
+    return static_cast<uint64_t>(v) ^ (uint64_t{1} << 63);
+  }
+
+  int64_t radix_value(uint64_t k)
+  {
+    return static_cast<int64_t>(k ^ (uint64_t{1} << 63));
+  }
+
+  // the stable order that sorts keys, by an LSD radix sort that carries
+  // each key's index
+  vector<size_t> radix_order(vector<uint64_t>&& keys)
+  {
+    auto n = keys.size();
+    vector<size_t> order(n);
+    for (size_t i = 0; i < n; ++i) order[i] = i;
+    vector<uint64_t> tmp_keys(n);
+    vector<size_t> tmp_order(n);
+    for (unsigned shift = 0; shift < 64; shift += 8) {
+      array<size_t, 257> offsets{};
+      for (auto k : keys) ++offsets[((k >> shift) & 0xff) + 1];
+      if (any_of(offsets.cbegin() + 1, offsets.cend(),
+                 [=] (size_t c) { return c == n; })) {
+        continue;
+      }
+      partial_sum(offsets.cbegin(), offsets.cend(), offsets.begin());
+      for (size_t i = 0; i < n; ++i) {
+        auto j = offsets[(keys[i] >> shift) & 0xff]++;
+        tmp_keys[j] = keys[i];
+        tmp_order[j] = order[i];
+      }
+      keys.swap(tmp_keys);
+      order.swap(tmp_order);
+    }
+    return order;
+  }
+}
+
+ColumnPtr sort_column(const Column& c)
+{
+  auto r = make_form<Column>(string(c.m_name), c.m_type);
+  if (c.m_type == Column::Type::I64) {
+    vector<uint64_t> keys(c.m_i64.size());
+    transform(c.m_i64.cbegin(), c.m_i64.cend(), keys.begin(), radix_key);
+    parallel_radix_sort(keys);
+    r->m_i64.resize(keys.size());
+    transform(keys.cbegin(), keys.cend(), r->m_i64.begin(), radix_value);
+    return r;
+  }
+
+  // rank the distinct strings once, then radix sort the ranks
+  vector<uint32_t> ids(c.m_str);
+  sort(ids.begin(), ids.end());
+  ids.erase(unique(ids.begin(), ids.end()), ids.end());
+  const auto& pool = string_pool();
+  sort(ids.begin(), ids.end(),
+       [&] (uint32_t a, uint32_t b) { return pool.lookup(a) < pool.lookup(b); });
+  unordered_map<uint32_t, uint64_t> rank;
+  for (size_t i = 0; i < ids.size(); ++i) rank.emplace(ids[i], i);
+
+  vector<uint64_t> keys(c.m_str.size());
+  transform(c.m_str.cbegin(), c.m_str.cend(), keys.begin(),
+            [&] (uint32_t id) { return rank[id]; });
+  parallel_radix_sort(keys);
+  r->m_str.resize(keys.size());
+  transform(keys.cbegin(), keys.cend(), r->m_str.begin(),
+            [&] (uint64_t k) { return ids[k]; });
+  return r;
+}
+
+// the elements of a list, slice or nil
+bool list_elements(const Form& f, vector<FormPtr>& v)
+{
+  if (auto l = dynamic_cast<const List*>(&f)) {
+    v = l->m_elements;
+  } else if (auto s = dynamic_cast<const ListSlice*>(&f)) {
+    v.assign(s->begin(), s->end());
+  } else if (!dynamic_cast<const Nil*>(&f)) {
+    return false;
+  }
+  return true;
+}
+
+// Stable sort of v by keys. Given less, a function of two keys, the sort
+// calls it to compare; otherwise the keys must be all numbers or all strings,
+// which are radix sorted.
+bool sort_by_keys(vector<FormPtr>& v, const vector<FormPtr>& keys,
+                  const Function* less, Environment& e)
+{
+  auto all = [&] (auto p) {
+    return all_of(keys.cbegin(), keys.cend(),
+                  [&] (const FormPtr& f) { return p(f.get()); });
+  };
+
+  vector<size_t> order;
+  if (less) {
+    order.resize(v.size());
+    for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+    bool failed = false;
+    stable_sort(order.begin(), order.end(), [&] (size_t i, size_t j) {
+        if (failed) return false;
+        auto r = call(*less, { keys[i], keys[j] }, e);
+        if (!r) failed = true;
+        return r && r->is_truthy();
+      });
+    if (failed) return false;
+  } else if (all([] (Form* f) { return dynamic_cast<Number*>(f); })) {
+    vector<uint64_t> radix_keys;
+    radix_keys.reserve(keys.size());
+    for (const auto& k : keys) {
+      radix_keys.push_back(
+          radix_key(static_cast<const Number&>(*k).m_value));
+    }
+    order = radix_order(std::move(radix_keys));
+  } else if (all([] (Form* f) { return dynamic_cast<String*>(f); })) {
+    // rank the distinct strings once, then radix sort the ranks
+    unordered_map<FormPtr, uint64_t, FormHash, FormEqual> ranks;
+    for (const auto& k : keys) ranks.emplace(k, 0);
+    vector<FormPtr> distinct;
+    for (const auto& r : ranks) distinct.push_back(r.first);
+    sort(distinct.begin(), distinct.end(),
+         [] (const FormPtr& x, const FormPtr& y) {
+           const auto& a = static_cast<const String&>(*x);
+           const auto& b = static_cast<const String&>(*y);
+           auto c = memcmp(a.data(), b.data(), min(a.size(), b.size()));
+           return c < 0 || (c == 0 && a.size() < b.size());
+         });
+    for (size_t i = 0; i < distinct.size(); ++i) ranks[distinct[i]] = i;
+    vector<uint64_t> radix_keys;
+    radix_keys.reserve(keys.size());
+    for (const auto& k : keys) radix_keys.push_back(ranks.find(k)->second);
+    order = radix_order(std::move(radix_keys));
+  } else {
+    cout << "Only numbers or strings sort without a comparator" << endl;
+    return false;
+  }
+
+  vector<FormPtr> sorted;
+  sorted.reserve(v.size());
+  for (auto i : order) sorted.push_back(std::move(v[i]));
+  v = std::move(sorted);
+  return true;
+}
+
+// the optional comparator argument to a sort: nil, for none, or a function
+bool sort_comparator(Environment& e, const string& arg, const string& fn,
+                     const Function*& less)
+{
+  auto f = e.lookup(arg);
+  less = dynamic_cast<const Function*>(f.get());
+  if (less || dynamic_cast<Nil*>(f.get())) return true;
+  cout << "Comparator argument to " << fn << " must be a function" << endl;
+  return false;
+}
+
+//------------------------------------------------------------------------------
+// Type names, for protocols and (type x)
+
+namespace
+{
+  const vector<pair<type_index, string>>& builtin_types()
+  {
+    static const vector<pair<type_index, string>> types = {
+      { typeid(Nil), "Nil" },
+      { typeid(True), "Boolean" },
+      { typeid(False), "Boolean" },
+      { typeid(List), "List" },
+      { typeid(ListSlice), "List" },
+      { typeid(String), "String" },
+      { typeid(Number), "Number" },
+      { typeid(Symbol), "Symbol" },
+      { typeid(Function), "Function" },
+      { typeid(BuiltinFunction), "Function" },
+      { typeid(SmallMap), "Map" },
+      { typeid(Column), "Column" },
+      { typeid(Table), "Table" },
+      { typeid(HashTable), "HashTable" },
+      { typeid(SortedMap), "SortedMap" },
+      { typeid(Bytes), "Bytes" },
+    };
+    return types;
+  }
+}
+
+string type_name(const Form& f)
+{
+  if (auto r = dynamic_cast<const Record*>(&f)) return r->m_type->m_name;
+  for (const auto& t : builtin_types()) {
+    if (t.first == typeid(f)) return t.second;
+  }
+  return "Form";
+}
+
+// for allocation reports, which see types rather than forms
+string type_name(type_index t)
+{
+  for (const auto& bt : builtin_types()) {
+    if (bt.first == t) return bt.second;
+  }
+  if (t == typeid(Environment)) return "Environment";
+  if (t == typeid(Record)) return "Record";
+  return t.name();
+}
+
+const void* type_key_by_name(const string& name, Environment& e)
+{
+  // the first entry with a name stands for every type sharing it, so that
+  // e.g. true and false share an implementation
+  for (const auto& t : builtin_types()) {
+    if (t.second == name) return &t.second;
+  }
+  auto c = dynamic_cast<RecordConstructor*>(e.lookup(name).get());
+  return c ? c->m_type.get() : nullptr;
+}
+
+// records dispatch on their RecordType; everything else on the key of its
+// type name, looked up once per type
+const void* type_key(const Form& f)
+{
+  if (auto r = dynamic_cast<const Record*>(&f)) return r->m_type.get();
+  static const unordered_map<type_index, const void*> keys = [] {
+    unordered_map<type_index, const void*> k;
+    for (const auto& t : builtin_types()) {
+      for (const auto& u : builtin_types()) {
+        if (u.second == t.second) {
+          k.emplace(t.first, &u.second);
+          break;
+        }
+      }
+    }
+    return k;
+  }();
+  auto i = keys.find(typeid(f));
+  return i == keys.end() ? nullptr : i->second;
+}
+
+// what a call site cache matches on: no lookups, just the dynamic type (or
+// the RecordType, since all records share one C++ type)
+const void* dispatch_key(const Form& f)
+{
+  const auto& t = typeid(f);
+  if (t == typeid(Record)) return static_cast<const Record&>(f).m_type.get();
+  return &t;
+}
+
+//------------------------------------------------------------------------------
+// Fetch a builtin argument of a given form type, or complain about it
+
+template <typename T>
+T* builtin_arg(Environment& e, const string& param,
+               const string& op, const string& type)
+{
+  auto p = dynamic_cast<T*>(e.lookup(param).get());
+  if (!p) {
+    static const char* ordinals[] =
+      { "First", "Second", "Third", "Fourth", "Fifth" };
+    cout << ordinals[param[0] - 'a'] << " argument to " << op
+         << " must be " << type << endl;
+  }
+  return p;
+}
+
+//------------------------------------------------------------------------------
+unique_ptr<Environment> create_base_env()
+{
+  auto e = make_unique<Environment>();
+  e->set("nil", make_form<Nil>());
+
+  e->set("+", make_form<BuiltinFunction>(
+             vector<string>{"a", "b"},
+             [] (Environment&e) -> FormPtr {
+               return builtin_numeric(e, "add", std::plus<int64_t>{});
+             }));
+  e->set("-", make_form<BuiltinFunction>(
+             vector<string>{"a", "b"},
+             [] (Environment&e) -> FormPtr {
+               return builtin_numeric(e, "subtract", std::minus<int64_t>{});
+             }));
+
+  e->set("*", make_form<BuiltinFunction>(
+             vector<string>{"a", "b"},
+             [] (Environment&e) -> FormPtr {
+               return builtin_numeric(e, "multiply", std::multiplies<int64_t>{});
+             }));
+
+  e->set("/", make_form<BuiltinFunction>(
+             vector<string>{"a", "b"},
+             [] (Environment&e) -> FormPtr {
+               return builtin_divide(e, "divide", std::divides<int64_t>{});
+             }));
+
+  e->set("%", make_form<BuiltinFunction>(
+             vector<string>{"a", "b"},
+             [] (Environment&e) -> FormPtr {
+               return builtin_divide(e, "mod", std::modulus<int64_t>{});
+             }));
+
+  e->set("read-csv", make_form<BuiltinFunction>(
+             vector<string>{"a"},
+             [] (Environment&e) -> FormPtr {
+               auto path = dynamic_cast<String*>(e.lookup("a").get());
+               if (!path) {
+                 cout << "Argument to read-csv must be a string" << endl;
+                 return nullptr;
+               }
+               return read_csv(path->value());
+             }));
+
+  e->set("count", make_form<BuiltinFunction>(
+             vector<string>{"a"},
+             [] (Environment&e) -> FormPtr {
+               FormPtr a = e.lookup("a");
+               if (auto l = dynamic_cast<List*>(a.get())) {
+                 return make_form<Number>(l->m_elements.size());
+               }
+               if (auto l = dynamic_cast<ListSlice*>(a.get())) {
+                 return make_form<Number>(l->m_size);
+               }
+               if (auto c = dynamic_cast<Column*>(a.get())) {
+                 return make_form<Number>(c->size());
+               }
+               if (auto t = dynamic_cast<Table*>(a.get())) {
+                 return make_form<Number>(t->rows());
+               }
+               if (auto t = dynamic_cast<HashTable*>(a.get())) {
+                 return make_form<Number>(t->m_table.size());
+               }
+               if (auto m = dynamic_cast<SortedMap*>(a.get())) {
+                 return make_form<Number>(m->m_tree.size());
+               }
+               if (auto b = dynamic_cast<Bytes*>(a.get())) {
+                 return make_form<Number>(b->m_size);
+               }
+               if (auto m = dynamic_cast<SmallMap*>(a.get())) {
+                 return make_form<Number>(m->m_values.size());
+               }
+               if (auto g = dynamic_cast<Grouping*>(a.get())) {
+                 return table_aggregate(*g, Aggregate::Count, string{});
+               }
+               if (auto s = dynamic_cast<String*>(a.get())) {
+                 return make_form<Number>(s->size());
+               }
+               if (dynamic_cast<Nil*>(a.get())) {
+                 return make_form<Number>(0);
+               }
+               cout << "Don't know how to count " << a->print() << endl;
+               return nullptr;
+             }));
+
+  e->set("nth", make_form<BuiltinFunction>(
+             vector<string>{"a", "b"},
+             [] (Environment&e) -> FormPtr {
+               FormPtr a = e.lookup("a");
+               auto n = dynamic_cast<Number*>(e.lookup("b").get());
+               if (!n || n->m_value < 0) {
+                 cout << "Second argument to nth must be a non-negative number"
+                      << endl;
+                 return nullptr;
+               }
+               auto i = static_cast<size_t>(n->m_value);
+               if (auto l = dynamic_cast<List*>(a.get())) {
+                 if (i < l->m_elements.size()) return l->m_elements[i];
+               } else if (auto l = dynamic_cast<ListSlice*>(a.get())) {
+                 if (i < l->m_size) return l->begin()[i];
+               } else if (auto c = dynamic_cast<Column*>(a.get())) {
+                 if (i < c->size()) return c->at(i);
+               } else {
+                 cout << "Don't know how to index " << a->print() << endl;
+                 return nullptr;
+               }
+               cout << "Index out of range: " << i << endl;
+               return nullptr;
+             }));
+
+  e->set("table", make_form<BuiltinFunction>(
+             vector<string>{"a"},
+             [] (Environment&e) -> FormPtr {
+               auto l = builtin_arg<List>(e, "a", "table", "a list of columns");
+               if (!l) return nullptr;
+               vector<ColumnPtr> columns;
+               for (const auto& f : l->m_elements) {
+                 auto c = dynamic_pointer_cast<Column>(f);
+                 if (!c || (!columns.empty()
+                            && c->size() != columns.front()->size())) {
+                   cout << "A table needs columns of equal length" << endl;
+                   return nullptr;
+                 }
+                 columns.push_back(c);
+               }
+               return make_form<Table>(std::move(columns));
+             }));
+
+  e->set("column", make_form<BuiltinFunction>(
+             vector<string>{"a", "b"},
+             [] (Environment&e) -> FormPtr {
+               auto t = builtin_arg<Table>(e, "a", "column", "a table");
+               auto n = builtin_arg<String>(e, "b", "column", "a string");
+               if (!t || !n) return nullptr;
+               auto c = t->find(n->value());
+               if (!c) cout << "No such column: " << n->value() << endl;
+               return c;
+             }));
+
+  e->set("select", make_form<BuiltinFunction>(
+             vector<string>{"a", "b"},
+             [] (Environment&e) -> FormPtr {
+               auto t = builtin_arg<Table>(e, "a", "select", "a table");
+               auto l = builtin_arg<List>(e, "b", "select",
+                                          "a list of column names");
+               if (!t || !l) return nullptr;
+               vector<ColumnPtr> columns;
+               for (const auto& f : l->m_elements) {
+                 auto n = dynamic_cast<String*>(f.get());
+                 auto c = n ? t->find(n->value()) : nullptr;
+                 if (!c) {
+                   cout << "No such column: " << f->print() << endl;
+                   return nullptr;
+                 }
+                 columns.push_back(c);
+               }
+               return make_form<Table>(std::move(columns));
+             }));
+
+  e->set("filter", make_form<BuiltinFunction>(
+             vector<string>{"a", "b", "c", "d"},
+             [] (Environment&e) -> FormPtr {
+               auto t = builtin_arg<Table>(e, "a", "filter", "a table");
+               auto n = builtin_arg<String>(e, "b", "filter", "a string");
+               auto op = builtin_arg<String>(e, "c", "filter", "a string");
+               if (!t || !n || !op) return nullptr;
+               return table_filter(*t, n->value(), op->value(), e.lookup("d"));
+             }));
+
+  e->set("group-by", make_form<BuiltinFunction>(
+             vector<string>{"a", "b"},
+             [] (Environment&e) -> FormPtr {
+               auto t = dynamic_pointer_cast<Table>(e.lookup("a"));
+               auto n = builtin_arg<String>(e, "b", "group-by", "a string");
+               if (!t) {
+                 cout << "First argument to group-by must be a table" << endl;
+               }
+               if (!t || !n) return nullptr;
+               return table_group_by(t, n->value());
+             }));
+
+  e->set("sum", make_form<BuiltinFunction>(
+             vector<string>{"a", "b"},
+             [] (Environment&e) -> FormPtr {
+               auto g = builtin_arg<Grouping>(e, "a", "sum", "a grouping");
+               auto n = builtin_arg<String>(e, "b", "sum", "a string");
+               if (!g || !n) return nullptr;
+               return table_aggregate(*g, Aggregate::Sum, n->value());
+             }));
+
+  e->set("mean", make_form<BuiltinFunction>(
+             vector<string>{"a", "b"},
+             [] (Environment&e) -> FormPtr {
+               auto g = builtin_arg<Grouping>(e, "a", "mean", "a grouping");
+               auto n = builtin_arg<String>(e, "b", "mean", "a string");
+               if (!g || !n) return nullptr;
+               return table_aggregate(*g, Aggregate::Mean, n->value());
+             }));
+
+  // (sort-by key-fn list [less]) or (sort-by table column-name)
+  e->set("sort-by", make_form<BuiltinFunction>(
+             vector<string>{"a", "b", "c"},
+             [] (Environment&e) -> FormPtr {
+               const Function* less;
+               if (!sort_comparator(e, "c", "sort-by", less)) return nullptr;
+               auto a = e.lookup("a");
+               if (auto f = dynamic_cast<Function*>(a.get())) {
+                 // call the key function once per element, not per comparison
+                 vector<FormPtr> v;
+                 if (!list_elements(*e.lookup("b"), v)) {
+                   cout << "Second argument to sort-by must be a list" << endl;
+                   return nullptr;
+                 }
+                 vector<FormPtr> keys;
+                 for (const auto& x : v) {
+                   auto k = call(*f, { x }, e);
+                   if (!k) return nullptr;
+                   keys.push_back(k);
+                 }
+                 if (!sort_by_keys(v, keys, less, e)) return nullptr;
+                 return make_list(std::move(v));
+               }
+
+               auto t = builtin_arg<Table>(e, "a", "sort-by",
+                                           "a function or a table");
+               auto n = builtin_arg<String>(e, "b", "sort-by", "a string");
+               if (!t || !n) return nullptr;
+               if (less) {
+                 cout << "sort-by on a table takes no comparator" << endl;
+                 return nullptr;
+               }
+               return table_sort_by(*t, n->value());
+             }, 1));
+
+  e->set("join", make_form<BuiltinFunction>(
+             vector<string>{"a", "b", "c"},
+             [] (Environment&e) -> FormPtr {
+               auto l = builtin_arg<Table>(e, "a", "join", "a table");
+               auto r = builtin_arg<Table>(e, "b", "join", "a table");
+               auto n = builtin_arg<String>(e, "c", "join", "a string");
+               if (!l || !r || !n) return nullptr;
+               return table_join(*l, *r, n->value());
+             }));
+
+  e->set("make-table", make_form<BuiltinFunction>(
+             vector<string>{},
+             [] (Environment&) -> FormPtr {
+               return make_form<HashTable>();
+             }));
+
+  e->set("table-get", make_form<BuiltinFunction>(
+             vector<string>{"a", "b"},
+             [] (Environment&e) -> FormPtr {
+               auto t = builtin_arg<HashTable>(e, "a", "table-get",
+                                               "a hash table");
+               if (!t) return nullptr;
+               auto v = t->m_table.find(*e.lookup("b"));
+               return v ? *v : make_form<Nil>();
+             }));
+
+  e->set("table-put!", make_form<BuiltinFunction>(
+             vector<string>{"a", "b", "c"},
+             [] (Environment&e) -> FormPtr {
+               auto t = builtin_arg<HashTable>(e, "a", "table-put!",
+                                               "a hash table");
+               if (!t) return nullptr;
+               return t->m_table[e.lookup("b")] = e.lookup("c");
+             }));
+
+  e->set("table-update!", make_form<BuiltinFunction>(
+             vector<string>{"a", "b", "c"},
+             [] (Environment&e) -> FormPtr {
+               auto t = builtin_arg<HashTable>(e, "a", "table-update!",
+                                               "a hash table");
+               auto f = builtin_arg<Function>(e, "c", "table-update!",
+                                              "a function");
+               if (!t || !f) return nullptr;
+               // the callback may insert and move slots, so the key is
+               // looked up again to store the result
+               auto k = e.lookup("b");
+               auto v = t->m_table.find(*k);
+               auto r = call(*f, { v ? *v : make_form<Nil>() }, e);
+               if (r) t->m_table[k] = r;
+               return r;
+             }));
+
+  e->set("table-for-each", make_form<BuiltinFunction>(
+             vector<string>{"a", "b"},
+             [] (Environment&e) -> FormPtr {
+               auto t = builtin_arg<HashTable>(e, "a", "table-for-each",
+                                               "a hash table");
+               auto f = builtin_arg<Function>(e, "b", "table-for-each",
+                                              "a function");
+               if (!t || !f) return nullptr;
+               auto ok = t->m_table.for_each(
+                 [&] (const FormPtr& k, const FormPtr& v) {
+                   call(*f, { k, v }, e);
+                 });
+               if (!ok) {
+                 cout << "Hash table keys added during table-for-each" << endl;
+                 return nullptr;
+               }
+               return make_form<Nil>();
+             }));
+
+  e->set("sorted-map", make_form<BuiltinFunction>(
+             vector<string>{"a"},
+             [] (Environment&e) -> FormPtr {
+               auto m = make_form<SortedMap>();
+               auto a = e.lookup("a");
+               if (dynamic_cast<Nil*>(a.get())) return m;
+               auto l = builtin_arg<List>(e, "a", "sorted-map",
+                                          "a list of (key value) pairs");
+               if (!l) return nullptr;
+
+               vector<pair<int64_t, FormPtr>> kvs;
+               for (const auto& f : l->m_elements) {
+                 auto p = dynamic_cast<List*>(f.get());
+                 auto k = p && p->m_elements.size() == 2
+                   ? dynamic_cast<Number*>(p->m_elements[0].get()) : nullptr;
+                 if (!k) {
+                   cout << "Sorted map entries must be (number value) pairs, got "
+                        << f->print() << endl;
+                   return nullptr;
+                 }
+                 kvs.emplace_back(k->m_value, p->m_elements[1]);
+               }
+
+               auto sorted = adjacent_find(
+                   kvs.cbegin(), kvs.cend(),
+                   [] (const auto& x, const auto& y) {
+                     return x.first >= y.first;
+                   }) == kvs.cend();
+               if (sorted) {
+                 m->m_tree.bulk_load(kvs);
+               } else {
+                 for (const auto& kv : kvs) m->m_tree.insert(kv.first, kv.second);
+               }
+               return m;
+             }));
+
+  e->set("sorted-get", make_form<BuiltinFunction>(
+             vector<string>{"a", "b"},
+             [] (Environment&e) -> FormPtr {
+               auto m = builtin_arg<SortedMap>(e, "a", "sorted-get",
+                                               "a sorted map");
+               auto k = builtin_arg<Number>(e, "b", "sorted-get", "a number");
+               if (!m || !k) return nullptr;
+               auto v = m->m_tree.find(k->m_value);
+               return v ? *v : make_form<Nil>();
+             }));
+
+  e->set("sorted-put!", make_form<BuiltinFunction>(
+             vector<string>{"a", "b", "c"},
+             [] (Environment&e) -> FormPtr {
+               auto m = builtin_arg<SortedMap>(e, "a", "sorted-put!",
+                                               "a sorted map");
+               auto k = builtin_arg<Number>(e, "b", "sorted-put!", "a number");
+               if (!m || !k) return nullptr;
+               auto v = e.lookup("c");
+               m->m_tree.insert(k->m_value, v);
+               return v;
+             }));
+
+  e->set("floor", make_form<BuiltinFunction>(
+             vector<string>{"a", "b"},
+             [] (Environment&e) -> FormPtr {
+               auto m = builtin_arg<SortedMap>(e, "a", "floor", "a sorted map");
+               auto k = builtin_arg<Number>(e, "b", "floor", "a number");
+               if (!m || !k) return nullptr;
+               int64_t key;
+               FormPtr value;
+               if (!m->m_tree.floor(k->m_value, key, value)) {
+                 return make_form<Nil>();
+               }
+               return make_pair_list(key, value);
+             }));
+
+  e->set("ceiling", make_form<BuiltinFunction>(
+             vector<string>{"a", "b"},
+             [] (Environment&e) -> FormPtr {
+               auto m = builtin_arg<SortedMap>(e, "a", "ceiling",
+                                               "a sorted map");
+               auto k = builtin_arg<Number>(e, "b", "ceiling", "a number");
+               if (!m || !k) return nullptr;
+               int64_t key;
+               FormPtr value;
+               if (!m->m_tree.ceiling(k->m_value, key, value)) {
+                 return make_form<Nil>();
+               }
+               return make_pair_list(key, value);
+             }));
+
+  // entries with lo <= key < hi
+  e->set("subrange", make_form<BuiltinFunction>(
+             vector<string>{"a", "b", "c"},
+             [] (Environment&e) -> FormPtr {
+               auto m = builtin_arg<SortedMap>(e, "a", "subrange",
+                                               "a sorted map");
+               auto lo = builtin_arg<Number>(e, "b", "subrange", "a number");
+               auto hi = builtin_arg<Number>(e, "c", "subrange", "a number");
+               if (!m || !lo || !hi) return nullptr;
+               vector<FormPtr> v;
+               m->m_tree.for_each_from(
+                   lo->m_value, [&] (int64_t k, const FormPtr& f) {
+                     if (k >= hi->m_value) return false;
+                     v.push_back(make_pair_list(k, f));
+                     return true;
+                   });
+               return make_list(std::move(v));
+             }));
+
+  e->set("sorted->list", make_form<BuiltinFunction>(
+             vector<string>{"a"},
+             [] (Environment&e) -> FormPtr {
+               auto m = builtin_arg<SortedMap>(e, "a", "sorted->list",
+                                               "a sorted map");
+               if (!m) return nullptr;
+               vector<FormPtr> v;
+               v.reserve(m->m_tree.size());
+               m->m_tree.for_each([&] (int64_t k, const FormPtr& f) {
+                   v.push_back(make_pair_list(k, f));
+                   return true;
+                 });
+               return make_list(std::move(v));
+             }));
+
+  e->set("make-bytes", make_form<BuiltinFunction>(
+             vector<string>{"a"},
+             [] (Environment&e) -> FormPtr {
+               auto n = builtin_arg<Number>(e, "a", "make-bytes", "a number");
+               if (!n) return nullptr;
+               if (n->m_value < 0 || n->m_value > Bytes::max_size) {
+                 cout << "Can't make " << n->m_value << " bytes" << endl;
+                 return nullptr;
+               }
+               return make_form<Bytes>(n->m_value);
+             }));
+
+  e->set("string->bytes", make_form<BuiltinFunction>(
+             vector<string>{"a"},
+             [] (Environment&e) -> FormPtr {
+               auto s = builtin_arg<String>(e, "a", "string->bytes",
+                                            "a string");
+               if (!s) return nullptr;
+               auto b = make_form<Bytes>(s->size());
+               memcpy(b->data(), s->data(), s->size());
+               return b;
+             }));
+
+  e->set("bytes->string", make_form<BuiltinFunction>(
+             vector<string>{"a"},
+             [] (Environment&e) -> FormPtr {
+               auto b = builtin_arg<Bytes>(e, "a", "bytes->string", "bytes");
+               if (!b) return nullptr;
+               auto p = reinterpret_cast<const char*>(b->data());
+               return make_form<String>(String::Raw{},
+                                          string(p, p + b->m_size));
+             }));
+
+  e->set("bytes-slice", make_form<BuiltinFunction>(
+             vector<string>{"a", "b", "c"},
+             [] (Environment&e) -> FormPtr {
+               auto b = builtin_arg<Bytes>(e, "a", "bytes-slice", "bytes");
+               auto start = builtin_arg<Number>(e, "b", "bytes-slice",
+                                                "a number");
+               auto end = builtin_arg<Number>(e, "c", "bytes-slice",
+                                              "a number");
+               if (!b || !start || !end) return nullptr;
+               if (start->m_value < 0 || end->m_value < start->m_value
+                   || static_cast<size_t>(end->m_value) > b->m_size) {
+                 cout << "Slice [" << start->m_value << ", " << end->m_value
+                      << ") out of range for " << b->print() << endl;
+                 return nullptr;
+               }
+               return make_form<Bytes>(b->m_buffer,
+                                         b->m_offset + start->m_value,
+                                         end->m_value - start->m_value);
+             }));
+
+  e->set("bytes-read", make_form<BuiltinFunction>(
+             vector<string>{"a", "b", "c", "d"},
+             [] (Environment&e) -> FormPtr {
+               auto b = builtin_arg<Bytes>(e, "a", "bytes-read", "bytes");
+               auto off = builtin_arg<Number>(e, "b", "bytes-read", "a number");
+               auto w = builtin_arg<Number>(e, "c", "bytes-read", "a number");
+               auto endian = builtin_arg<String>(e, "d", "bytes-read",
+                                                 "\"le\" or \"be\"");
+               if (!b || !off || !w || !endian) return nullptr;
+               bool big_endian;
+               if (!parse_endian(*endian, big_endian)) return nullptr;
+               if (!valid_width(w->m_value)
+                   || !in_bounds(off->m_value, w->m_value, b->m_size)) {
+                 cout << "Can't read " << w->m_value << " bytes at offset "
+                      << off->m_value << " of " << b->print() << endl;
+                 return nullptr;
+               }
+               return make_form<Number>(static_cast<int64_t>(
+                   read_uint(b->data() + off->m_value, w->m_value,
+                             big_endian)));
+             }));
+
+  e->set("bytes-write!", make_form<BuiltinFunction>(
+             vector<string>{"a", "b", "c", "d", "e"},
+             [] (Environment&e) -> FormPtr {
+               auto b = builtin_arg<Bytes>(e, "a", "bytes-write!", "bytes");
+               auto off = builtin_arg<Number>(e, "b", "bytes-write!",
+                                              "a number");
+               auto w = builtin_arg<Number>(e, "c", "bytes-write!", "a number");
+               auto endian = builtin_arg<String>(e, "d", "bytes-write!",
+                                                 "\"le\" or \"be\"");
+               auto v = builtin_arg<Number>(e, "e", "bytes-write!", "a number");
+               if (!b || !off || !w || !endian || !v) return nullptr;
+               bool big_endian;
+               if (!parse_endian(*endian, big_endian)) return nullptr;
+               if (!valid_width(w->m_value)
+                   || !in_bounds(off->m_value, w->m_value, b->m_size)) {
+                 cout << "Can't write " << w->m_value << " bytes at offset "
+                      << off->m_value << " of " << b->print() << endl;
+                 return nullptr;
+               }
+               write_uint(b->data() + off->m_value, w->m_value, big_endian,
+                          static_cast<uint64_t>(v->m_value));
+               return e.lookup("e");
+             }));
+
+  e->set("bytes-find", make_form<BuiltinFunction>(
+             vector<string>{"a", "b"},
+             [] (Environment&e) -> FormPtr {
+               auto b = builtin_arg<Bytes>(e, "a", "bytes-find", "bytes");
+               if (!b) return nullptr;
+               auto needle = e.lookup("b");
+               const uint8_t* p = nullptr;
+               if (auto nb = dynamic_cast<Bytes*>(needle.get())) {
+                 p = find_bytes(b->data(), b->m_size, nb->data(), nb->m_size);
+               } else if (auto ns = dynamic_cast<String*>(needle.get())) {
+                 p = find_bytes(b->data(), b->m_size,
+                                reinterpret_cast<const uint8_t*>(
+                                    ns->data()),
+                                ns->size());
+               } else {
+                 cout << "Second argument to bytes-find must be bytes "
+                      << "or a string" << endl;
+                 return nullptr;
+               }
+               if (!p) return make_form<Nil>();
+               return make_form<Number>(p - b->data());
+             }));
+
+  e->set("subs", make_form<BuiltinFunction>(
+             vector<string>{"a", "b", "c"},
+             [] (Environment&e) -> FormPtr {
+               auto s = builtin_arg<String>(e, "a", "subs", "a string");
+               auto start = builtin_arg<Number>(e, "b", "subs", "a number");
+               auto end = builtin_arg<Number>(e, "c", "subs", "a number");
+               if (!s || !start || !end
+                   || !slice_bounds(*s, s->size(), *start, *end)) {
+                 return nullptr;
+               }
+               return substring(*s, start->m_value,
+                                end->m_value - start->m_value);
+             }));
+
+  e->set("subvec", make_form<BuiltinFunction>(
+             vector<string>{"a", "b", "c"},
+             [] (Environment&e) -> FormPtr {
+               auto a = e.lookup("a");
+               auto start = builtin_arg<Number>(e, "b", "subvec", "a number");
+               auto end = builtin_arg<Number>(e, "c", "subvec", "a number");
+               if (!start || !end) return nullptr;
+
+               shared_ptr<List> l = dynamic_pointer_cast<List>(a);
+               size_t offset = 0;
+               size_t size = l ? l->m_elements.size() : 0;
+               if (auto slice = dynamic_cast<ListSlice*>(a.get())) {
+                 l = slice->m_list;
+                 offset = slice->m_offset;
+                 size = slice->m_size;
+               } else if (!l && !dynamic_cast<Nil*>(a.get())) {
+                 cout << "First argument to subvec must be a list" << endl;
+                 return nullptr;
+               }
+               if (!slice_bounds(*a, size, *start, *end)) return nullptr;
+               return sublist(l, offset + start->m_value,
+                              end->m_value - start->m_value);
+             }));
+
+  e->set("compact", make_form<BuiltinFunction>(
+             vector<string>{"a"},
+             [] (Environment&e) -> FormPtr {
+               return compact(e.lookup("a"));
+             }));
+
+  e->set("re-find", make_form<BuiltinFunction>(
+             vector<string>{"a", "b"},
+             [] (Environment&e) -> FormPtr {
+               auto pat = builtin_arg<String>(e, "a", "re-find", "a string");
+               auto s = builtin_arg<String>(e, "b", "re-find", "a string");
+               auto re = pat && s ? regex_cache().get(pat->value()) : nullptr;
+               if (!re) return nullptr;
+               FormPtr r = make_form<Nil>();
+               re->for_each_match(s->data(), s->size(),
+                                  [&] (size_t start, size_t end) {
+                                    r = substring(*s, start, end - start);
+                                    return false;
+                                  });
+               return r;
+             }));
+
+  e->set("re-matches", make_form<BuiltinFunction>(
+             vector<string>{"a", "b"},
+             [] (Environment&e) -> FormPtr {
+               auto pat = builtin_arg<String>(e, "a", "re-matches", "a string");
+               auto s = builtin_arg<String>(e, "b", "re-matches", "a string");
+               auto re = pat && s ? regex_cache().get(pat->value()) : nullptr;
+               if (!re) return nullptr;
+               if (re->matches(s->data(), s->size())) return e.lookup("b");
+               return make_form<Nil>();
+             }));
+
+  e->set("re-seq", make_form<BuiltinFunction>(
+             vector<string>{"a", "b"},
+             [] (Environment&e) -> FormPtr {
+               auto pat = builtin_arg<String>(e, "a", "re-seq", "a string");
+               auto s = builtin_arg<String>(e, "b", "re-seq", "a string");
+               auto re = pat && s ? regex_cache().get(pat->value()) : nullptr;
+               if (!re) return nullptr;
+               vector<FormPtr> v;
+               re->for_each_match(s->data(), s->size(),
+                                  [&] (size_t start, size_t end) {
+                                    v.push_back(
+                                        substring(*s, start, end - start));
+                                    return true;
+                                  });
+               return make_list(std::move(v));
+             }));
+
+  // (sort list-or-column [less])
+  e->set("sort", make_form<BuiltinFunction>(
+             vector<string>{"a", "b"},
+             [] (Environment&e) -> FormPtr {
+               const Function* less;
+               if (!sort_comparator(e, "b", "sort", less)) return nullptr;
+               auto a = e.lookup("a");
+               if (auto c = dynamic_cast<Column*>(a.get())) {
+                 if (!less) return sort_column(*c);
+                 // sort the row numbers by the boxed elements
+                 vector<FormPtr> rows, keys;
+                 for (size_t i = 0; i < c->size(); ++i) {
+                   rows.push_back(make_form<Number>(i));
+                   keys.push_back(c->at(i));
+                 }
+                 if (!sort_by_keys(rows, keys, less, e)) return nullptr;
+                 vector<size_t> order;
+                 for (const auto& r : rows) {
+                   order.push_back(
+                       static_cast<size_t>(
+                           static_cast<const Number&>(*r).m_value));
+                 }
+                 return gather(*c, order);
+               }
+               vector<FormPtr> v;
+               if (!list_elements(*a, v)) {
+                 cout << "Argument to sort must be a list or a column" << endl;
+                 return nullptr;
+               }
+               if (!sort_by_keys(v, vector<FormPtr>(v), less, e)) {
+                 return nullptr;
+               }
+               return make_list(std::move(v));
+             }, 1));
+
+  e->set("=", make_form<BuiltinFunction>(
+             vector<string>{"a", "b"},
+             [] (Environment&e) -> FormPtr {
+               if (forms_equal(e.lookup("a"), e.lookup("b"))) {
+                 return make_form<True>();
+               }
+               return make_form<False>();
+             }));
+
+  // numbers or strings, for sort comparators
+  e->set("<", make_form<BuiltinFunction>(
+             vector<string>{"a", "b"},
+             [] (Environment&e) -> FormPtr {
+               auto a = e.lookup("a");
+               auto b = e.lookup("b");
+               auto an = dynamic_cast<Number*>(a.get());
+               auto bn = dynamic_cast<Number*>(b.get());
+               auto as = dynamic_cast<String*>(a.get());
+               auto bs = dynamic_cast<String*>(b.get());
+               bool less;
+               if (an && bn) {
+                 less = an->m_value < bn->m_value;
+               } else if (as && bs) {
+                 auto c = memcmp(as->data(), bs->data(),
+                                 min(as->size(), bs->size()));
+                 less = c < 0 || (c == 0 && as->size() < bs->size());
+               } else {
+                 cout << "Don't know how to compare " << a->print()
+                      << " and " << b->print() << endl;
+                 return nullptr;
+               }
+               if (less) return make_form<True>();
+               return make_form<False>();
+             }));
+
+  e->set("hash", make_form<BuiltinFunction>(
+             vector<string>{"a"},
+             [] (Environment&e) -> FormPtr {
+               return make_form<Number>(
+                   static_cast<int64_t>(e.lookup("a")->hash()));
+             }));
+
+  e->set("make-map", make_form<BuiltinFunction>(
+             vector<string>{"a"},
+             [] (Environment&e) -> FormPtr {
+               FormPtr m = make_form<SmallMap>(Shape::root(),
+                                                 vector<FormPtr>{});
+               vector<FormPtr> entries;
+               if (!list_elements(*e.lookup("a"), entries)) {
+                 cout << "Argument to make-map must be a list of "
+                      << "(key value) pairs" << endl;
+                 return nullptr;
+               }
+               for (const auto& f : entries) {
+                 auto p = dynamic_cast<List*>(f.get());
+                 auto k = p && p->m_elements.size() == 2
+                   ? dynamic_pointer_cast<Symbol>(p->m_elements[0]) : nullptr;
+                 if (!k) {
+                   cout << "Map entries must be (symbol value) pairs, got "
+                        << f->print() << endl;
+                   return nullptr;
+                 }
+                 m = assoc(static_cast<SmallMap&>(*m), k, p->m_elements[1]);
+               }
+               return m;
+             }));
+
+  e->set("assoc", make_form<BuiltinFunction>(
+             vector<string>{"a", "b", "c"},
+             [] (Environment&e) -> FormPtr {
+               auto m = builtin_arg<SmallMap>(e, "a", "assoc", "a map");
+               auto k = dynamic_pointer_cast<Symbol>(e.lookup("b"));
+               if (!k) cout << "Second argument to assoc must be a symbol" << endl;
+               if (!m || !k) return nullptr;
+               return assoc(*m, k, e.lookup("c"));
+             }));
+
+  e->set("get", make_form<BuiltinFunction>(
+             vector<string>{"a", "b"},
+             [] (Environment&e) -> FormPtr {
+               auto m = builtin_arg<SmallMap>(e, "a", "get", "a map");
+               auto k = builtin_arg<Symbol>(e, "b", "get", "a symbol");
+               if (!m || !k) return nullptr;
+               auto i = m->slot(*k);
+               return i == Shape::npos ? make_form<Nil>() : m->m_values[i];
+             }));
+
+  e->set("keys", make_form<BuiltinFunction>(
+             vector<string>{"a"},
+             [] (Environment&e) -> FormPtr {
+               auto m = builtin_arg<SmallMap>(e, "a", "keys", "a map");
+               if (!m) return nullptr;
+               return make_list(vector<FormPtr>(m->m_shape->m_keys.cbegin(),
+                                                m->m_shape->m_keys.cend()));
+             }));
+
+  // (defmethod multi dispatch-value fn); :default catches everything else
+  e->set("defmethod", make_form<BuiltinFunction>(
+             vector<string>{"a", "b", "c"},
+             [] (Environment&e) -> FormPtr {
+               auto m = builtin_arg<MultiFn>(e, "a", "defmethod",
+                                             "a multimethod");
+               if (!m) return nullptr;
+               auto f = dynamic_pointer_cast<Function>(e.lookup("c"));
+               if (!f || f->m_params.size() != m->m_params.size()) {
+                 cout << "Third argument to defmethod must be a function of "
+                      << m->m_params.size() << " arguments" << endl;
+                 return nullptr;
+               }
+               auto value = e.lookup("b");
+               if (value->symb_eq(":default")) {
+                 m->m_default = f;
+               } else {
+                 m->m_methods[value] = f;
+               }
+               ++dispatch_version;
+               return e.lookup("a");
+             }));
+
+  e->set("type", make_form<BuiltinFunction>(
+             vector<string>{"a"},
+             [] (Environment&e) -> FormPtr {
+               return make_form<Symbol>(type_name(*e.lookup("a")));
+             }));
+
+  // (profile-calls true) starts counting calls, time and allocations per
+  // function; (profile-report) prints them, most exclusive time first
+  e->set("profile-calls", make_form<BuiltinFunction>(
+             vector<string>{"a"},
+             [] (Environment&e) -> FormPtr {
+               auto on = e.lookup("a");
+               profile_calls(on->is_truthy());
+               return on;
+             }));
+
+  // (profile-allocations n) attributes every allocation to its type and
+  // function, and samples the stack of one in n; (profile-allocations 0)
+  // stops
+  e->set("profile-allocations", make_form<BuiltinFunction>(
+             vector<string>{"a"},
+             [] (Environment&e) -> FormPtr {
+               auto n = builtin_arg<Number>(e, "a", "profile-allocations",
+                                            "a number");
+               if (!n) return nullptr;
+               if (n->m_value < 0) {
+                 cout << "Sampling period must not be negative" << endl;
+                 return nullptr;
+               }
+               profile_allocations(static_cast<unsigned>(n->m_value));
+               return e.lookup("a");
+             }));
+
+  e->set("allocation-report", make_form<BuiltinFunction>(
+             vector<string>{},
+             [] (Environment&) -> FormPtr {
+               allocation_report(cout);
+               return make_form<Nil>();
+             }));
+
+  e->set("profile-report", make_form<BuiltinFunction>(
+             vector<string>{},
+             [] (Environment&) -> FormPtr {
+               profile_report(cout);
+               return make_form<Nil>();
+             }));
+
+  // (break "name"), (break (quote name)) or (break "file:line") stops
+  // before every call to name, on entry to it if it is a lambda, or at the
+  // first list evaluated on the line; unbreak removes the breakpoint
+  e->set("break", make_form<BuiltinFunction>(
+             vector<string>{"a"},
+             [] (Environment&e) -> FormPtr {
+               return set_breakpoint(e.lookup("a"));
+             }));
+
+  e->set("unbreak", make_form<BuiltinFunction>(
+             vector<string>{"a"},
+             [] (Environment&e) -> FormPtr {
+               return clear_breakpoint(e.lookup("a"));
+             }));
+
+  // (step (quote expr)) evaluates expr where step was called, stopping at
+  // its first list
+  e->set("step", make_form<BuiltinFunction>(
+             vector<string>{"a"},
+             [] (Environment&e) -> FormPtr {
+               return step_into(e.lookup("a"), *e.parent());
+             }));
+
+  return e;
+}
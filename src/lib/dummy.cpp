@@ -1,4 +0,0 @@
-int dummy()
-{
-  return 1;
-}
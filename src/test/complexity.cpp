@@ -0,0 +1,75 @@
+#define TESTINATOR_MAIN
+#include <testinator.h>
+
+#include "blisp.h"
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+//------------------------------------------------------------------------------
+// Asymptotic guarantees. Each property takes an arbitrary string and uses
+// only its length as the input size N, so that the inputs are valid blisp
+// and the fit measures the interpreter rather than the generator.
+
+namespace
+{
+  // (1 2 3 ... n)
+  string number_list(size_t n)
+  {
+    string s = "(";
+    for (size_t i = 1; i <= n; ++i) {
+      s += to_string(i);
+      s += ' ';
+    }
+    s += ')';
+    return s;
+  }
+
+  // about n tokens of every kind the REPL sees
+  string source_text(size_t n)
+  {
+    string s;
+    for (size_t i = 0; i < n; i += 8) {
+      s += "(f \"x\" (g 42 y) nil) ";
+    }
+    return s;
+  }
+}
+
+//------------------------------------------------------------------------------
+
+DEF_COMPLEXITY_PROPERTY(TokenizerIsLinear, Complexity, ORDER_N,
+                        const string& s)
+{
+  tokenizer(source_text(s.size()));
+}
+
+DEF_COMPLEXITY_PROPERTY(ReadIsLinear, Complexity, ORDER_N, const string& s)
+{
+  read(number_list(s.size()));
+}
+
+DEF_COMPLEXITY_PROPERTY(PrintIsLinear, Complexity, ORDER_N, const string& s)
+{
+  read(number_list(s.size()))->print();
+}
+
+// Scope is dynamic, so a lookup walks every frame between the call site and
+// the binding: building a chain of N frames and resolving a name from the
+// root through all of them must stay linear, not quadratic.
+DEF_COMPLEXITY_PROPERTY(EnvironmentChainIsLinear, Complexity, ORDER_N,
+                        const string& s)
+{
+  auto root = create_base_env();
+  vector<unique_ptr<Environment>> chain;
+  Environment* e = root.get();
+  for (size_t i = 0; i < s.size(); ++i) {
+    chain.push_back(make_unique<Environment>(e));
+    e = chain.back().get();
+  }
+  e->lookup("+");
+}
@@ -0,0 +1,41 @@
+# Starts the interpreter with its metrics endpoint, scrapes it once with
+# curl and checks the exposition lines. The interpreter reads its stdin from
+# curl's, so it stays up until the scrape is done.
+set(sock "${DIR}/metrics.sock")
+set(body "${DIR}/metrics.txt")
+set(victim "${DIR}/metrics_victim.txt")
+file(REMOVE "${sock}" "${body}")
+
+# an ordinary file at the socket path is left alone
+file(WRITE "${victim}" "keep me\n")
+execute_process(COMMAND "${EXE}" "--metrics-socket=${victim}"
+  INPUT_FILE /dev/null
+  OUTPUT_VARIABLE output
+  RESULT_VARIABLE result)
+if(result EQUAL 0 OR NOT output MATCHES "not a socket"
+   OR NOT EXISTS "${victim}")
+  message(FATAL_ERROR "metrics endpoint replaced an ordinary file:\n${output}")
+endif()
+
+execute_process(
+  COMMAND "${CURL}" -s -S --retry 50 --retry-delay 0 --retry-all-errors
+          --unix-socket "${sock}" -o "${body}" http://localhost/metrics
+  COMMAND "${EXE}" "--metrics-socket=${sock}"
+  OUTPUT_QUIET
+  RESULTS_VARIABLE results)
+if(NOT results STREQUAL "0;0")
+  message(FATAL_ERROR "scrape failed: ${results}")
+endif()
+
+file(READ "${body}" text)
+foreach(line
+    "# TYPE blisp_evaluations_total counter\n"
+    "\nblisp_evaluations_total [0-9]+\n"
+    "\nblisp_calls_total [0-9]+\n"
+    "\nblisp_forms_created_total [0-9]+\n"
+    "\nblisp_live_forms [0-9]+\n"
+    "\nblisp_inline_cache_lookups_total{cache=\"map\",result=\"hit\"} [0-9]+\n")
+  if(NOT text MATCHES "${line}")
+    message(FATAL_ERROR "no line matching ${line} in:\n${text}")
+  endif()
+endforeach()
@@ -0,0 +1,43 @@
+# Runs a script through the interpreter and compares its output with the
+# expected output beside it. A NAME.in beside the script is fed to stdin.
+# With a NAME.info beside it, the script runs under --coverage and the lcov
+# it writes must match NAME.info. Timings vary from run to run, so they are
+# compared as "N ms" and "N us".
+get_filename_component(dir "${SCRIPT}" DIRECTORY)
+get_filename_component(name "${SCRIPT}" NAME_WE)
+get_filename_component(file "${SCRIPT}" NAME)
+
+set(input /dev/null)
+if(EXISTS "${dir}/${name}.in")
+  set(input "${dir}/${name}.in")
+endif()
+
+set(args)
+set(lcov "${CMAKE_CURRENT_BINARY_DIR}/${name}.info")
+if(EXISTS "${dir}/${name}.info")
+  file(REMOVE "${lcov}")
+  set(args "--coverage=${lcov}")
+endif()
+
+execute_process(COMMAND "${EXE}" ${args} "${file}"
+  WORKING_DIRECTORY "${dir}"
+  INPUT_FILE "${input}"
+  OUTPUT_VARIABLE output
+  RESULT_VARIABLE result)
+file(READ "${dir}/${name}.out" expected)
+string(REGEX REPLACE "[0-9]+\\.[0-9]+ (ms|us)" "N \\1" output "${output}")
+
+if(NOT result EQUAL 0)
+  message(FATAL_ERROR "${file} exited with ${result}:\n${output}")
+endif()
+if(NOT output STREQUAL expected)
+  message(FATAL_ERROR "${file}: expected\n${expected}\ngot\n${output}")
+endif()
+if(args)
+  file(READ "${dir}/${name}.info" expected)
+  file(READ "${lcov}" output)
+  if(NOT output STREQUAL expected)
+    message(FATAL_ERROR
+      "${file}: expected coverage\n${expected}\ngot\n${output}")
+  endif()
+endif()
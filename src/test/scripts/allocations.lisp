@@ -0,0 +1,6 @@
+(set! sq (lambda (x) (* x x)))
+(profile-allocations 1000000)
+(sq 3)
+(sq (sq 2))
+(profile-allocations 0)
+(allocation-report)
@@ -0,0 +1,15 @@
+(set! b (string->bytes "abcdefgh"))
+(bytes-read b 0 2 "le")
+(bytes-read b 0 2 "be")
+(bytes-read b 0 2 "xx")
+(bytes-write! b 0 2 "LE" 1)
+(bytes-write! b 6 2 "be" 25185)
+(bytes->string b)
+(bytes-read b 7 2 "le")
+(bytes-read b 8 1 "le")
+(bytes-read b (- 0 1) 1 "le")
+(bytes-read b 4611686018427387904 8 "le")
+(bytes-write! b 9223372036854775807 8 "be" 0)
+(bytes-read b 0 3 "le")
+(make-bytes 100000000000000)
+(make-bytes 4294967297)
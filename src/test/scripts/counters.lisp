@@ -0,0 +1,12 @@
+(with-counters () (+ 1 2))
+(nth (with-counters (:instructions) (+ 1 2)) 0)
+(keys (nth (with-counters (:instructions :cycles) (+ 1 2)) 1))
+(let (c (get (nth (with-counters (:instructions) (+ 1 2)) 1) (quote :instructions))) (if (= c nil) true (< 0 c)))
+(count (keys (nth (with-counters (:cache-references :cache-misses :branches :branch-misses) 0) 1)))
+(with-counters (bogus) 1)
+(with-counters ("cycles") 1)
+(with-counters (cycles) 1)
+(with-counters :cycles 1)
+(with-counters (:cycles))
+(with-counters (:cycles) (nth 1 0))
+(with-counters () (with-counters () 4))
@@ -0,0 +1,7 @@
+(set! sign (lambda (n) (if (< n 0) (quote negative) (if (= n 0) (quote zero) (quote positive)))))
+(sign 5)
+(sign 0)
+(sign 7)
+(set! unused (lambda (n) (if n 1 2)))
+(set! loop (lambda (n) (if (< 0 n) (loop (- n 1)) (quote done))))
+(loop 3)
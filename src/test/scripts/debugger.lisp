@@ -0,0 +1,20 @@
+(set! sq (lambda (x) (* x x)))
+(break "sq")
+(sq (+ 1 2))
+(sq (sq 2))
+(unbreak (quote sq))
+(sq 5)
+(set! id (lambda (x) x))
+(break "id")
+(id 7)
+(unbreak "id")
+(set! y 4)
+(step (quote (sq y)))
+(break "debugger.lisp:15")
+(sq 8)
+(sq 9)
+(unbreak "debugger.lisp:15")
+(break sq)
+(sq 10)
+(set! g (lambda (x) (+ x 1)))
+(let (y (make-bytes "a")) (step (quote (g 1))))
@@ -0,0 +1,32 @@
+(= 1 1)
+(= 1 2)
+(= "ab" "ab")
+(= "ab" "abc")
+(= (quote a) (quote a))
+(= (quote a) "a")
+(= (quote (1 (2 "x") b)) (quote (1 (2 "x") b)))
+(= (quote (1 (2 "x") b)) (quote (1 (2 "y") b)))
+(= (quote (1 2)) (quote (1 2 3)))
+(= nil nil)
+(= nil (quote ()))
+(= true true)
+(= true false)
+(= (string->bytes "ab") (string->bytes "ab"))
+(= (make-map (quote ((a 1) (b 2)))) (make-map (quote ((a 1) (b 2)))))
+(= (make-map (quote ((a 1)))) (make-map (quote ((a 2)))))
+(= (hash 42) (hash 42))
+(= (hash "hello") (hash "hello"))
+(= (hash (quote (1 (2 "x") b))) (hash (quote (1 (2 "x") b))))
+(= (hash (make-map (quote ((a 1) (b 2))))) (hash (make-map (quote ((a 1) (b 2))))))
+(= (hash (string->bytes "ab")) (hash (string->bytes "ab")))
+(= (hash (quote (1 2))) (hash (quote (2 1))))
+(= (hash "ab") (hash "ba"))
+(set! t (make-table))
+(table-put! t (quote (1 "x")) "list key")
+(table-get t (quote (1 "x")))
+(table-get t (quote (1 "y")))
+(= sort sort)
+(= sort count)
+(= (make-map (quote ((a 1) (b 2)))) (make-map (quote ((b 2) (a 1)))))
+(= (hash (make-map (quote ((a 1) (b 2))))) (hash (make-map (quote ((b 2) (a 1))))))
+(hash)
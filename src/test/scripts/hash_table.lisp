@@ -0,0 +1,16 @@
+(set! t (make-table))
+(set! fill (lambda (n) (if (= n 0) nil (begin (table-put! t n n) (fill (- n 1))))))
+(table-update! t 0 (lambda (v) (begin (fill 100) 42)))
+(table-get t 0)
+(table-get t 100)
+(table-update! t 0 (lambda (v) (+ v 1)))
+(table-update! t 7 (lambda (v) undefined-value))
+(table-get t 7)
+(table-get t 1000)
+(table-update! t 1000 (lambda (v) undefined-value))
+(table-get t 1000)
+(set! u (make-table))
+(table-put! u 1 1)
+(table-for-each u (lambda (k v) (table-put! u (+ k 1) v)))
+(table-for-each u (lambda (k v) (table-put! u k (+ v 1))))
+(table-get u 1)
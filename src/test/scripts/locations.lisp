@@ -0,0 +1,10 @@
+x
+(+ 1 y)
+   (car z)
+(set! f (lambda (a) (+ a w)))
+(f 1)
+(if true (begin 1 (undefined-fn 2)) 3)
+(3 4)
+("s" 1)
+(count (nth (quote (1 2)) bad))
+(f (g 1))
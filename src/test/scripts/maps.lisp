@@ -0,0 +1,28 @@
+(set! m (make-map (quote ((a 1) (b 2)))))
+m
+(get m (quote a))
+(get m (quote b))
+(get m (quote c))
+(keys m)
+(count (keys m))
+(assoc m (quote c) 3)
+(assoc m (quote a) 10)
+m
+(make-map nil)
+(keys (make-map nil))
+(set! get-a (lambda (x) (get x (quote a))))
+(get-a m)
+(get-a m)
+(get-a (make-map (quote ((b 5) (a 6)))))
+(get-a (make-map (quote ((b 7)))))
+(get-a (make-map (quote ((c 8) (b 9) (a 10)))))
+(get-a m)
+(= (keys (make-map (quote ((a 1) (b 2))))) (keys m))
+(make-map 3)
+(make-map (quote ((a 1) (2 b))))
+(make-map (quote ((a 1 2))))
+(assoc 3 (quote a) 1)
+(assoc m "a" 1)
+(get m "a")
+(get 3 (quote a))
+(keys 3)
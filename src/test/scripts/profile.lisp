@@ -0,0 +1,10 @@
+(set! f (lambda (x) (begin (profile-calls false) (profile-calls true) x)))
+(set! g (lambda (x) (f x)))
+(profile-calls true)
+(g 1)
+(g 2)
+(profile-calls false)
+(profile-calls true)
+(g 3)
+(profile-calls false)
+(profile-calls false)
@@ -0,0 +1,18 @@
+(defprotocol Show (show (x)))
+(defrecord Point (x y))
+(defrecord Size (x y))
+(extend-type Boolean Show (show (lambda (x) "bool")))
+(extend-type Number Show (show (lambda (x) "num")))
+(extend-type Point Show (show (lambda (p) (Point-x p))))
+(set! describe (lambda (x) (show x)))
+(describe true)
+(describe false)
+(describe 3)
+(describe (Point 7 8))
+(describe (Size 1 2))
+(describe "str")
+(describe true)
+(describe (Point 9 8))
+(extend-type Size Show (show (lambda (s) "size")))
+(describe (Size 1 2))
+(extend-type Nosuch Show (show (lambda (x) x)))
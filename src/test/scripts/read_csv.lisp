@@ -0,0 +1,9 @@
+(set! t (read-csv "data/people.csv"))
+(nth (nth t 0) 2)
+(nth (nth t 1) 0)
+(nth (nth t 1) 1)
+(nth (nth t 2) 2)
+(read-csv "data")
+(read-csv "data/missing.csv")
+(read-csv "data/short_row.csv")
+(read-csv "data/open_quote.csv")
@@ -0,0 +1,26 @@
+(defrecord Point (x y))
+(set! p (Point 1 2))
+p
+(Point-x p)
+(Point-y p)
+(Point? p)
+(Point? 3)
+(type p)
+(defrecord Empty ())
+(Empty)
+(Empty? (Empty))
+(Point? (Empty))
+(Point-x (Empty))
+(Point-x 3)
+(Point 1)
+(Point 1 2 3)
+(= (Point 1 2) (Point 1 2))
+(= (Point 1 2) (Point 2 1))
+(= (Point 1 2) (quote (Point 1 2)))
+(= (hash (Point 1 2)) (hash (Point 1 2)))
+(defrecord Line (from to))
+(Point-y (Line-to (Line (Point 0 0) (Point 5 6))))
+(defrecord)
+(defrecord "Q" (a))
+(defrecord Q a)
+(defrecord Q (a "b"))
@@ -0,0 +1,19 @@
+(re-seq "a|bc" "abcxabc")
+(re-seq "a+" "caaab aa")
+(re-seq "x*" "axxb")
+(re-find "a[^z]*z|a" "aaaz")
+(re-matches "a\\$" "a$")
+(re-matches "a\\\\$" "a\\")
+(re-matches "a\\\\$" "a\\b")
+(re-find "b\\\\\\$" "b\\$c")
+(set! b (make-bytes 131072))
+(set! fill (lambda (lo n) (if (= n 8) (bytes-write! b lo 8 "le" 7016996765293437281) (begin (fill lo (/ n 2)) (fill (+ lo (/ n 2)) (/ n 2))))))
+(fill 0 131072)
+(count (re-seq "a|a[^z]*z" (bytes->string b)))
+(bytes-write! b 131071 1 "le" 122)
+(count (re-seq "a|a[^z]*z" (bytes->string b)))
+(count (re-seq "z|aa|a" (bytes->string b)))
+(count (set! ab (nth (nth (read-csv "data/ab.csv") 0) 0)))
+(re-find "x((a|b)*a(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)y)?" ab)
+(count (re-seq "a(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)" ab))
+(count (re-seq "(a|b)*a(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)y" ab))
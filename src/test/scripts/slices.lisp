@@ -0,0 +1,25 @@
+(set! s "the quick brown fox jumps over the lazy dog")
+(subs s 4 9)
+(subs (subs s 4 19) 6 11)
+(subs s 0 0)
+(subs s 10 44)
+(subs s 5 4)
+(count (subs s 4 43))
+(= (subs s 4 9) "quick")
+(= (hash (subs s 31 34)) (hash "the"))
+(compact (subs s 10 43))
+(set! l (quote (1 2 3 4 5 6 7 8)))
+(subvec l 2 5)
+(subvec (subvec l 2 7) 1 3)
+(nth (subvec l 3 8) 4)
+(nth (subvec l 3 8) 5)
+(count (subvec l 1 8))
+(subvec l 0 0)
+(subvec l 3 9)
+(subvec nil 0 0)
+(subvec "abc" 0 1)
+(= (subvec l 0 3) (quote (1 2 3)))
+(= (hash (subvec l 5 8)) (hash (quote (6 7 8))))
+(compact (subvec l 6 8))
+(type (subvec l 1 2))
+(sort (subvec (quote (5 3 9 1)) 1 4))
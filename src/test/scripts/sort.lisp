@@ -0,0 +1,16 @@
+(sort (quote (3 1 20 0 1)))
+(sort (quote ("pear" "apple" "fig" "apple")))
+(sort (quote (3 "a" 1)))
+(set! by-type (lambda (a b) (if (= (type a) (type b)) (< a b) (= (type a) (quote Number)))))
+(sort (quote (3 "a" 1 "b")) by-type)
+(sort (quote (3 1 2)) (lambda (a b) (< b a)))
+(sort (quote (2 1)) (lambda (a b) undefined-thing))
+(sort (quote (2 1)) 5)
+(sort-by (lambda (x) (nth x 1)) (quote ((a 2) (b 1) (c 2))))
+(sort-by (lambda (x) (nth x 1)) (quote ((a 2) (b 1) (c 2))) (lambda (a b) (< b a)))
+(sort-by (lambda (x) x) (quote ((1) (2))))
+(sort nil)
+(set! c (sort (nth (read-csv "data/people.csv") 2) (lambda (a b) (< b a))))
+(nth c 0)
+(nth c 2)
+(nth (sort (nth (read-csv "data/people.csv") 2)) 0)
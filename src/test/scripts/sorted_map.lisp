@@ -0,0 +1,31 @@
+(set! n 10007)
+(set! m (sorted-map nil))
+(set! fill (lambda (lo k) (if (= k 1) (let (key (* 3 (% (* lo 7919) n))) (sorted-put! m key key)) (begin (fill lo (/ k 2)) (fill (+ lo (/ k 2)) (- k (/ k 2)))))))
+(set! bad (lambda (t lo k) (if (= k 1) (if (= (sorted-get t (* 3 lo)) (* 3 lo)) 0 1) (+ (bad t lo (/ k 2)) (bad t (+ lo (/ k 2)) (- k (/ k 2)))))))
+(fill 0 n)
+(count (sorted->list m))
+(bad m 0 n)
+(sorted-get m 1)
+(floor m 3001)
+(ceiling m 3001)
+(floor m 3000)
+(floor m (- 0 1))
+(ceiling m 30019)
+(floor m 1000000)
+(subrange m 10 20)
+(count (subrange m 300 3000))
+(subrange m 5 5)
+(set! b (sorted-map (sorted->list m)))
+(= (sorted->list b) (sorted->list m))
+(bad b 0 n)
+(floor b 29999)
+(ceiling b 29999)
+(count (subrange b 0 30019))
+(sorted-put! b 1 1)
+(sorted-put! b 4 4)
+(sorted-put! b 3 "three")
+(subrange b 0 7)
+(count (sorted->list b))
+(sorted->list (sorted-map (quote ((3 c) (1 a) (2 b) (1 z)))))
+(sorted->list (sorted-map (quote ((3 c) (1 a) (2 b)))))
+(sorted-map (quote ((a 1))))
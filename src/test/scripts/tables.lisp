@@ -0,0 +1,32 @@
+(set! fill-vals (lambda (m c i) (if (< i (count c)) (begin (sorted-put! m i (nth c i)) (fill-vals m c (+ i 1))) nil)))
+(set! vals (lambda (c) (let (m (sorted-map nil)) (begin (fill-vals m c 0) (sorted->list m)))))
+(set! t (table (read-csv "data/sales.csv")))
+(count t)
+(vals (column t "qty"))
+(column t "nope")
+(vals (column (filter t "qty" ">" 2) "qty"))
+(vals (column (filter t "qty" "<=" 2) "product"))
+(vals (column (filter t "region" "=" "north") "qty"))
+(vals (column (filter t "region" "!=" "north") "region"))
+(filter t "region" "<" "north")
+(filter t "qty" "=" "x")
+(filter t "qty" "~" 1)
+(set! g (group-by t "region"))
+(count g)
+(vals (column (sum g "qty") "region"))
+(vals (column (sum g "qty") "sum"))
+(vals (column (mean g "qty") "mean"))
+(vals (column (count g) "count"))
+(sum g "product")
+(vals (column (sort-by t "qty") "qty"))
+(vals (column (sort-by t "product") "product"))
+(vals (column (sort-by t "region") "qty"))
+(select t (quote ("qty" "region")))
+(select t (quote ("qty" "zone")))
+(set! r (table (read-csv "data/regions.csv")))
+(set! j (join t r "region"))
+j
+(vals (column j "manager"))
+(vals (column j "qty"))
+(join t r "qty")
+(table (quote ()))
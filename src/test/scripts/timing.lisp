@@ -0,0 +1,15 @@
+(time (+ 1 2))
+(time (count (quote (1 2 3))))
+(time (nth 1 0))
+(time)
+(time 1 2)
+(keys (bench (+ 1 2) :warmup 2 :iters 5))
+(count (keys (bench (+ 1 2))))
+(bench (+ 1 2) :iters 0)
+(bench (+ 1 2) :warmup (- 0 1))
+(bench (+ 1 2) :warmup "x")
+(bench (+ 1 2) :samples 3)
+(bench (+ 1 2) :iters)
+(bench)
+(bench (nth 1 0) :warmup 0 :iters 1)
+(with-counters () (time 5))